@@ -0,0 +1,86 @@
+/*
+ * convtrace.c - Converts memory traces between lackey's text format
+ *     and the binary format of tracefile.h, or copies a range of one
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "tracefile.h"
+
+/*
+ * usage - Print usage info
+ */
+void usage(char *argv[])
+{
+    printf("Usage: %s [-h] [-b | -t] [-f <first>] [-n <count>] <in> <out>\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h          Print this help message.\n");
+    printf("  -b          Write the binary format (default for a text <in>).\n");
+    printf("  -t          Write lackey text (default for a binary <in>).\n");
+    printf("  -f <first>  Start at access <first>, from 0, counting 'I's.\n");
+    printf("  -n <count>  Copy only <count> accesses.\n");
+    printf("<in> and <out> may be - for stdin and stdout.\n");
+    printf("Examples:\n");
+    printf("  %s traces/long.trace long.bin\n", argv[0]);
+    printf("  %s -f 100000 -n 20 long.bin -\n", argv[0]);
+}
+
+int main(int argc, char *argv[])
+{
+    int c, binary = -1, n, i;
+    unsigned long long first = 0, count = ~0ULL, done = 0, skipped = 0;
+    trace_reader_t *reader;
+    trace_writer_t *writer;
+    struct trace_ref refs[TRACE_BLOCK];
+
+    while ((c = getopt(argc, argv, "hbtf:n:")) != -1) {
+        switch (c) {
+        case 'b':
+            binary = 1;
+            break;
+        case 't':
+            binary = 0;
+            break;
+        case 'f':
+            first = strtoull(optarg, NULL, 0);
+            break;
+        case 'n':
+            count = strtoull(optarg, NULL, 0);
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv);
+        exit(1);
+    }
+
+    reader = trace_open(argv[optind], 1);
+    if (binary < 0)
+        binary = !trace_is_binary(reader);
+
+    /* Jump to the first access through the index if there is one */
+    if (first > 0 && trace_seek(reader, first) == 0)
+        skipped = first;
+    writer = trace_create(argv[optind + 1], binary);
+
+    while (done < count && (n = trace_read(reader, refs, TRACE_BLOCK)) > 0) {
+        for (i = 0; i < n && done < count; i++) {
+            if (skipped < first) {
+                skipped++;
+                continue;
+            }
+            trace_write(writer, &refs[i]);
+            done++;
+        }
+    }
+    trace_finish(writer);
+    trace_close(reader);
+    return 0;
+}
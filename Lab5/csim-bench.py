@@ -0,0 +1,72 @@
+#!/usr/bin/python
+#
+# csim-bench.py - Times csim's tag match and LRU implementations
+#     (csim -k scalar, sse2, avx2) against each other for a range of
+#     associativities. Each cell is csim -T's simulation rate, in
+#     millions of accesses per second, best of -r runs; parsing the
+#     trace is not counted.
+#
+from __future__ import print_function
+import subprocess;
+import re;
+import sys;
+import optparse;
+
+#
+# run_csim - Run csim once and return its simulation rate, or None if
+# it can't run the implementation on this CPU
+#
+def run_csim(impl, s, E, b, trace):
+    cmd = ["./csim", "-T", "-k", impl, "-s", str(s), "-E", str(E),
+           "-b", str(b), "-t", trace]
+    p = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    stdout_data = p.communicate()[0].decode()
+    if p.returncode != 0:
+        return None
+    rate = re.findall(r'^' + impl + r': .*\(([\d.]+) M accesses/s\)',
+                      stdout_data, re.M)
+    return float(rate[0])
+
+#
+# main - Main function
+#
+def main():
+
+    # Parse the command line arguments
+    p = optparse.OptionParser()
+    p.add_option("-t", dest="trace", default="traces/long.trace",
+                 help="trace file (default traces/long.trace)")
+    p.add_option("-s", dest="s", type="int", default=4,
+                 help="set index bits (default 4)")
+    p.add_option("-b", dest="b", type="int", default=4,
+                 help="block offset bits (default 4)")
+    p.add_option("-E", dest="E", default="1,2,4,8,16,32,64",
+                 help="comma-separated lines per set (default 1,2,4,...,64)")
+    p.add_option("-r", dest="runs", type="int", default=3,
+                 help="runs per cell, best counts (default 3)")
+    opts, args = p.parse_args()
+
+    impls = ["scalar", "sse2", "avx2"]
+    print("%s, s=%d b=%d: M accesses/s" % (opts.trace, opts.s, opts.b))
+    print("%6s" % "E", end="")
+    for impl in impls:
+        print("%10s" % impl, end="")
+    print("%12s" % "best/scalar")
+
+    for E in [int(e) for e in opts.E.split(",")]:
+        print("%6d" % E, end="")
+        rates = {}
+        for impl in impls:
+            runs = [run_csim(impl, opts.s, E, opts.b, opts.trace)
+                    for i in range(opts.runs)]
+            if None in runs:
+                print("%10s" % "-", end="")
+                continue
+            rates[impl] = max(runs)
+            print("%10.1f" % rates[impl], end="")
+        print("%11.2fx" % (max(rates.values()) / rates["scalar"]))
+        sys.stdout.flush()
+
+# execute main only if called as a script
+if __name__ == "__main__":
+    main()
@@ -1,211 +1,866 @@
 /*
  * Name:Taekang Eom, POVIS ID:tkeom0114
  */
+#define _POSIX_C_SOURCE 200809L
 #include "cachelab.h"
+#include "tracefile.h"
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <getopt.h>
 #include <math.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
 
-struct cache_param {
+/* Trace lines read and then simulated at a time */
+#define REFS 4096
+
+/* Largest E with 16-bit LRU ages, which SSE2/AVX2 compare signed */
+#define MAX_SIMD_E 32767
+
+/* Smallest E for which the default is SIMD; scalar loops win below it */
+#define SIMD_MIN_E 16
+
+/* Most configurations in one sweep */
+#define MAX_CONFIGS 4096
+
+/* Trace accesses read at a time in a sweep, shared by its configurations */
+#define SWEEP_REFS 65536
+
+/* Bytes in a host cache line */
+#define LINE_BYTES 64
+
+/*
+ * A cache of S = 2^s sets of E lines each, stored as flat arrays
+ * (struct of arrays) so that a lookup walks one set's tags in a
+ * single pass. Lines are never invalidated, so a set's valid lines
+ * are always its first fill[set] lines.
+ *
+ * LRU order is kept as a 16-bit age per valid line: 0 for the most
+ * recently used line of the set, n-1 for the least recently used of
+ * n. Using a line of age a ages by one every line younger than a and
+ * makes it 0, so a full set's victim is the line of age E-1. Sets of
+ * more than MAX_SIMD_E lines keep 32-bit ages in wide_ages instead,
+ * and are simulated by run_cache_wide with scalar loops.
+ *
+ * A sweep deals neighbouring caches to different threads, and the
+ * counts change on every access, so each cache has its own host cache
+ * lines.
+ */
+struct cache {
     int s;
-    int S;
     int E;
     int b;
-    int B;
+    unsigned long long set_mask;
+    unsigned long long *tags;   /* S*E tags; set i's lines start at i*E */
+    unsigned short *ages;       /* S*E LRU ages, laid out like tags */
+    unsigned int *wide_ages;    /* the same, instead, for E > MAX_SIMD_E */
+    int *fill;                  /* number of valid lines in each set */
+    struct lru_impl *impl;
+    unsigned long long count;
     int hits;
     int misses;
     int evictions;
     int show;
-    long long count;
+} __attribute__((aligned(LINE_BYTES)));
+
+/* A cache configuration to simulate: 2^s sets of E lines of 2^b bytes */
+struct config {
+    int s;
+    int E;
+    int b;
 };
 
-struct cache_line {
-    long long tag;
-    int last_used;
-    int valid;
+/*
+ * One implementation of the per-set work:
+ *
+ * match - Index of the line among the first n whose tag is tag, or -1.
+ * touch - Add one to the age of each of the first n lines younger than age.
+ * oldest - Index of the line among the first n whose age is n-1.
+ */
+struct lru_impl {
+    char *name;
+    int (*match)(const unsigned long long *tags, int n, unsigned long long tag);
+    void (*touch)(unsigned short *ages, int n, int age);
+    int (*oldest)(const unsigned short *ages, int n);
 };
 
 void print_usage()
 {
-    printf("Usage: ./csim [-hv] -s <num> -E <num> -b <num> -t <file>\n");
+    printf("Usage: ./csim [-hvT] [-k <impl>] [-j <threads>] -s <num> -E <num> -b <num> -t <file>\n");
+    printf("       ./csim [-T] [-k <impl>] [-j <threads>] -c <s:E:b>,... -t <file>\n");
     printf("Options:\n");
     printf("  -h         Print this help message.\n");
     printf("  -v         Optional verbose flag.\n");
     printf("  -s <num>   Number of set index bits.\n");
     printf("  -E <num>   Number of lines per set.\n");
     printf("  -b <num>   Number of block offset bits.\n");
-    printf("  -t <file>  Trace file.\n");
+    printf("  -t <file>  Trace file, text or binary, or - to read it from stdin.\n");
+    printf("  -k <impl>  Tag match and LRU code: scalar, sse2 or avx2\n");
+    printf("             (default: scalar for E < %d, else the fastest\n", SIMD_MIN_E);
+    printf("             this CPU runs). Only scalar takes E > %d.\n", MAX_SIMD_E);
+    printf("  -T         Report accesses per second.\n");
+    printf("  -c <list>  Configurations to simulate, as s:E:b,s:E:b,...\n");
+    printf("  -j <num>   Threads to simulate the configurations on (default 1).\n");
+    printf("With more than one configuration, csim simulates all of them in one\n");
+    printf("pass over the trace. -s, -E and -b also take lists like 1,2,4 or 2-6,\n");
+    printf("for every combination of their values.\n");
     printf("\nExamples:\n");
     printf("  ./csim -s 4 -E 1 -b 4 -t traces/yi.trace\n");
     printf("  ./csim -v -s 8 -E 2 -b 4 -t traces/yi.trace\n");
+    printf("  valgrind --log-fd=1 --tool=lackey --trace-mem=yes ls -l |\n");
+    printf("      ./csim -s 8 -E 2 -b 4 -t -\n");
+    printf("  ./csim -j 4 -s 2-8 -E 1,2,4,8 -b 4,5,6 -t traces/long.trace\n");
+}
+
+int match_scalar(const unsigned long long *tags, int n, unsigned long long tag)
+{
+    for(int i = 0; i < n; i++)
+    {
+        if(tags[i] == tag)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void touch_scalar(unsigned short *ages, int n, int age)
+{
+    for(int i = 0; i < n; i++)
+    {
+        ages[i] += ages[i] < age;
+    }
+}
+
+int oldest_scalar(const unsigned short *ages, int n)
+{
+    for(int i = 0; i < n; i++)
+    {
+        if(ages[i] == n - 1)
+        {
+            return i;
+        }
+    }
+    return 0;
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * SSE2 has no 64-bit compare, so a tag matches where both of its
+ * 32-bit halves do.
+ */
+int match_sse2(const unsigned long long *tags, int n, unsigned long long tag)
+{
+    __m128i key = _mm_set1_epi64x((long long) tag);
+    int i;
+
+    for(i = 0; i + 2 <= n; i += 2)
+    {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i *) (tags + i)), key);
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(eq));
+        if(mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    if(i < n && tags[i] == tag)
+    {
+        return i;
+    }
+    return -1;
 }
 
-int find_hit(struct cache_line **cache, struct cache_param param, int set_index ,long long tag)
+void touch_sse2(unsigned short *ages, int n, int age)
 {
-    int index = -1;
-    for(int i=0;i < param.E; i++)
+    __m128i limit = _mm_set1_epi16((short) age);
+    int i;
+
+    for(i = 0; i + 8 <= n; i += 8)
     {
-        if(cache[set_index][i].valid && cache[set_index][i].tag == tag)
+        __m128i *p = (__m128i *) (ages + i);
+        __m128i v = _mm_loadu_si128(p);
+        /* The compare gives -1 where the line is younger; subtract it */
+        _mm_storeu_si128(p, _mm_sub_epi16(v, _mm_cmplt_epi16(v, limit)));
+    }
+    touch_scalar(ages + i, n - i, age);
+}
+
+int oldest_sse2(const unsigned short *ages, int n)
+{
+    __m128i key = _mm_set1_epi16((short) (n - 1));
+    int i;
+
+    for(i = 0; i + 8 <= n; i += 8)
+    {
+        __m128i eq = _mm_cmpeq_epi16(_mm_loadu_si128((__m128i *) (ages + i)), key);
+        int mask = _mm_movemask_epi8(eq);
+        if(mask)
         {
-            index = i;
-            break;
+            return i + __builtin_ctz(mask) / 2;
         }
     }
-    return index;
+    for(; i < n; i++)
+    {
+        if(ages[i] == n - 1)
+        {
+            return i;
+        }
+    }
+    return 0;
+}
+
+__attribute__((target("avx2")))
+int match_avx2(const unsigned long long *tags, int n, unsigned long long tag)
+{
+    __m256i key = _mm256_set1_epi64x((long long) tag);
+    int i;
+
+    for(i = 0; i + 4 <= n; i += 4)
+    {
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i *) (tags + i)), key);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        if(mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    for(; i < n; i++)
+    {
+        if(tags[i] == tag)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+__attribute__((target("avx2")))
+void touch_avx2(unsigned short *ages, int n, int age)
+{
+    __m256i limit = _mm256_set1_epi16((short) age);
+    int i;
+
+    for(i = 0; i + 16 <= n; i += 16)
+    {
+        __m256i *p = (__m256i *) (ages + i);
+        __m256i v = _mm256_loadu_si256(p);
+        _mm256_storeu_si256(p, _mm256_sub_epi16(v, _mm256_cmpgt_epi16(limit, v)));
+    }
+    for(; i < n; i++)
+    {
+        ages[i] += ages[i] < age;
+    }
 }
 
-int find_empty(struct cache_line **cache, struct cache_param param, int set_index)
+__attribute__((target("avx2")))
+int oldest_avx2(const unsigned short *ages, int n)
 {
-    int index = -1;
-    for(int i=0;i < param.E; i++)
+    __m256i key = _mm256_set1_epi16((short) (n - 1));
+    int i;
+
+    for(i = 0; i + 16 <= n; i += 16)
+    {
+        __m256i eq = _mm256_cmpeq_epi16(_mm256_loadu_si256((__m256i *) (ages + i)), key);
+        unsigned mask = _mm256_movemask_epi8(eq);
+        if(mask)
+        {
+            return i + __builtin_ctz(mask) / 2;
+        }
+    }
+    for(; i < n; i++)
     {
-        if(!cache[set_index][i].valid)
+        if(ages[i] == n - 1)
         {
-            index = i;
-            break;
+            return i;
         }
     }
-    return index;
+    return 0;
 }
+#endif
 
-int find_evict(struct cache_line **cache, struct cache_param param, int set_index)
+struct lru_impl impls[] = {
+#ifdef HAVE_X86_SIMD
+    {"avx2", match_avx2, touch_avx2, oldest_avx2},
+    {"sse2", match_sse2, touch_sse2, oldest_sse2},
+#endif
+    {"scalar", match_scalar, touch_scalar, oldest_scalar},
+    {NULL, NULL, NULL, NULL}
+};
+
+/*
+ * find_impl - The implementation called name, or with name NULL, the
+ *     best for sets of E lines: scalar for small or very large sets,
+ *     else the first in impls that this CPU can run. NULL if there is
+ *     no such implementation or the CPU can't run it.
+ */
+struct lru_impl *find_impl(char *name, int E)
 {
-    int index = 0;
-    int last_used = cache[set_index][0].last_used;
-    for(int i=1;i < param.E; i++)
+    if(name == NULL && (E < SIMD_MIN_E || E > MAX_SIMD_E))
+    {
+        name = "scalar";
+    }
+    for(struct lru_impl *impl = impls; impl->name != NULL; impl++)
     {
-        if(cache[set_index][i].last_used < last_used)
+        if(name != NULL && strcmp(name, impl->name) != 0)
         {
-            index = i;
-            last_used = cache[set_index][i].last_used;
+            continue;
         }
+#ifdef HAVE_X86_SIMD
+        if(strcmp(impl->name, "avx2") == 0 && !__builtin_cpu_supports("avx2"))
+        {
+            if(name != NULL)
+            {
+                return NULL;
+            }
+            continue;
+        }
+#endif
+        return impl;
+    }
+    return NULL;
+}
+
+void init_cache(struct cache *cache, int s, int E, int b, struct lru_impl *impl, int show)
+{
+    long S = 1L << s;
+
+    cache->s = s;
+    cache->E = E;
+    cache->b = b;
+    cache->set_mask = S - 1;
+    cache->tags = malloc(S * E * sizeof(unsigned long long));
+    cache->ages = NULL;
+    cache->wide_ages = NULL;
+    if(E > MAX_SIMD_E)
+    {
+        cache->wide_ages = malloc(S * E * sizeof(unsigned int));
     }
-    return index;
+    else
+    {
+        cache->ages = malloc(S * E * sizeof(unsigned short));
+    }
+    cache->fill = calloc(S, sizeof(int));
+    if(cache->tags == NULL || (cache->ages == NULL && cache->wide_ages == NULL) || cache->fill == NULL)
+    {
+        fprintf(stderr, "csim: out of memory for %ld sets of %d lines\n", S, E);
+        exit(1);
+    }
+    cache->impl = impl;
+    cache->count = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
+    cache->show = show;
+}
+
+void free_cache(struct cache *cache)
+{
+    free(cache->tags);
+    free(cache->ages);
+    free(cache->wide_ages);
+    free(cache->fill);
 }
 
-struct cache_param run_cache(struct cache_line **cache, struct cache_param param, long long address)
+/*
+ * run_cache_wide - run_cache for sets of more than MAX_SIMD_E lines,
+ *     with 32-bit ages and scalar loops.
+ */
+void run_cache_wide(struct cache *cache, unsigned long long address)
 {
-    param.count++;
-    int set_index = (int) ((address >> param.b) % param.S);
-    long long tag = address >> (param.s + param.b);
-    int line_index;
-    int hit_index = find_hit(cache, param, set_index, tag);
-    int empty_index = find_empty(cache, param, set_index);
-    int evict_index = find_evict(cache, param, set_index);
-    if(hit_index != -1)
+    unsigned long long set = (address >> cache->b) & cache->set_mask;
+    unsigned long long tag = address >> (cache->s + cache->b);
+    unsigned long long *tags = cache->tags + set * cache->E;
+    unsigned int *ages = cache->wide_ages + set * cache->E;
+    unsigned int age;
+    int n = cache->fill[set];
+    int line, i;
+
+    cache->count++;
+    line = match_scalar(tags, n, tag);
+    if(line >= 0)
     {
-        param.hits++;
-        line_index = hit_index;
-        if(param.show)
+        cache->hits++;
+        if(cache->show)
         {
             printf(" hit");
         }
+        age = ages[line];
     }
     else
     {
-        param.misses++;
-        if(param.show)
+        cache->misses++;
+        if(cache->show)
         {
             printf(" miss");
         }
-        if(empty_index != -1)
+        if(n < cache->E)
         {
-            line_index = empty_index;
+            line = n;
+            cache->fill[set]++;
+            age = n;
         }
         else
         {
-            param.evictions++;
-            line_index = evict_index;
-            if(param.show)
+            cache->evictions++;
+            if(cache->show)
             {
                 printf(" eviction");
             }
+            line = 0;
+            while(ages[line] != n - 1)
+            {
+                line++;
+            }
+            age = n - 1;
         }
+        tags[line] = tag;
     }
-    cache[set_index][line_index].last_used = param.count;
-    cache[set_index][line_index].tag = tag;
-    cache[set_index][line_index].valid = 1;
-    return param;
+    for(i = 0; i < n; i++)
+    {
+        ages[i] += ages[i] < age;
+    }
+    ages[line] = 0;
 }
 
-int main(int argc, char **argv)
+/*
+ * run_cache - Simulate one access: look for the tag among the set's
+ *     valid lines and, if it misses, fill the next empty line or evict
+ *     the oldest. Then make the line the set's youngest.
+ */
+void run_cache(struct cache *cache, unsigned long long address)
 {
-    int option=0;
-    struct cache_param param;
-    char *file_name;
-    
-
-    while((option = getopt(argc, argv, "hvs:E:b:t:"))!=EOF)
-	{
-        
-		switch(option)
-		{
-			case 's': param.s = atoi(optarg); break;
-			case 'E': param.E = atoi(optarg); break;
-            case 'b': param.b = atoi(optarg); break;
-            case 't': file_name = optarg; break;
-            case 'h': print_usage(); return 0;
-            case 'v': param.show = 1; break;
-			default: print_usage(); return 1;
-		}
-	}
-
-	param.S = 1 << param.s;
-    param.B = 1 << param.b;
-    param.count = 0;
-    param.evictions = 0;
-    param.misses = 0;
-    param.hits = 0;
-
-    struct cache_line **cache = malloc(param.S * sizeof(struct cache_line*));
-    for(int i=0; i < param.S; i++)
-    {
-        cache[i] = malloc(param.E * sizeof(struct cache_line));
-    }
-
-    FILE *trace;
-    
-    char operation;
-    long long address;
-    int size;
-
-    trace = fopen(file_name, "r");
-    if (trace != NULL) {
-		while (fscanf(trace, " %c %llx,%d", &operation, &address, &size) == 3) {
-            if(param.show && operation != 'I')
+    unsigned long long set = (address >> cache->b) & cache->set_mask;
+    unsigned long long tag = address >> (cache->s + cache->b);
+    unsigned long long *tags = cache->tags + set * cache->E;
+    unsigned short *ages;
+    int n = cache->fill[set];
+    int line;
+
+    if(cache->wide_ages != NULL)
+    {
+        run_cache_wide(cache, address);
+        return;
+    }
+    ages = cache->ages + set * cache->E;
+    cache->count++;
+    line = cache->impl->match(tags, n, tag);
+    if(line >= 0)
+    {
+        cache->hits++;
+        if(cache->show)
+        {
+            printf(" hit");
+        }
+        cache->impl->touch(ages, n, ages[line]);
+        ages[line] = 0;
+        return;
+    }
+
+    cache->misses++;
+    if(cache->show)
+    {
+        printf(" miss");
+    }
+    if(n < cache->E)
+    {
+        line = n;
+        cache->fill[set]++;
+        cache->impl->touch(ages, n, n);
+    }
+    else
+    {
+        cache->evictions++;
+        if(cache->show)
+        {
+            printf(" eviction");
+        }
+        line = cache->impl->oldest(ages, n);
+        cache->impl->touch(ages, n, n - 1);
+    }
+    tags[line] = tag;
+    ages[line] = 0;
+}
+
+void simulate(struct cache *cache, struct trace_ref *refs, int n)
+{
+    for(int i = 0; i < n; i++)
+    {
+        if(cache->show)
+        {
+            printf("%c %llx,%d", refs[i].op, refs[i].addr, refs[i].size);
+        }
+        switch(refs[i].op) {
+            case 'L':
+                run_cache(cache, refs[i].addr);
+                break;
+            case 'S':
+                run_cache(cache, refs[i].addr);
+                break;
+            case 'M':
+                run_cache(cache, refs[i].addr);
+                run_cache(cache, refs[i].addr);
+                break;
+            default:
+                break;
+        }
+        if(cache->show)
+        {
+            printf("\n");
+        }
+    }
+}
+
+double now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * parse_list - Parse a comma-separated list of numbers and ranges,
+ *     like "1,2,4" or "2-6", into vals. Returns how many there are,
+ *     or -1 if arg is malformed or has more than max.
+ */
+int parse_list(char *arg, int *vals, int max)
+{
+    int n = 0;
+    char *p = arg, *end;
+
+    for(;;)
+    {
+        long lo = strtol(p, &end, 10), hi = lo;
+        if(end == p)
+        {
+            return -1;
+        }
+        if(*end == '-')
+        {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if(end == p || hi < lo)
+            {
+                return -1;
+            }
+        }
+        for(long v = lo; v <= hi; v++)
+        {
+            if(n == max)
+            {
+                return -1;
+            }
+            vals[n++] = v;
+        }
+        if(*end == '\0')
+        {
+            return n;
+        }
+        if(*end != ',')
+        {
+            return -1;
+        }
+        p = end + 1;
+    }
+}
+
+/*
+ * parse_configs - Fill configs with the -c list ("s:E:b,s:E:b,...")
+ *     if there is one, else with every combination of the -s, -E and
+ *     -b lists. Returns how many configurations, or -1 on a bad list.
+ */
+int parse_configs(char *config_arg, char *s_arg, char *E_arg, char *b_arg,
+                  struct config *configs, int max)
+{
+    int n = 0;
+
+    if(config_arg != NULL)
+    {
+        char *p = config_arg;
+        int used;
+
+        while(n < max && sscanf(p, "%d:%d:%d%n", &configs[n].s, &configs[n].E,
+                                &configs[n].b, &used) == 3)
+        {
+            n++;
+            p += used;
+            if(*p == '\0')
+            {
+                return n;
+            }
+            if(*p++ != ',')
+            {
+                return -1;
+            }
+        }
+        return -1;
+    }
+
+    int s_vals[MAX_CONFIGS], E_vals[MAX_CONFIGS], b_vals[MAX_CONFIGS];
+    int ns, nE, nb;
+
+    if(s_arg == NULL || E_arg == NULL || b_arg == NULL ||
+       (ns = parse_list(s_arg, s_vals, MAX_CONFIGS)) < 0 ||
+       (nE = parse_list(E_arg, E_vals, MAX_CONFIGS)) < 0 ||
+       (nb = parse_list(b_arg, b_vals, MAX_CONFIGS)) < 0 ||
+       (long) ns * nE * nb > max)
+    {
+        return -1;
+    }
+    for(int i = 0; i < ns; i++)
+    {
+        for(int j = 0; j < nE; j++)
+        {
+            for(int k = 0; k < nb; k++)
+            {
+                configs[n].s = s_vals[i];
+                configs[n].E = E_vals[j];
+                configs[n].b = b_vals[k];
+                n++;
+            }
+        }
+    }
+    return n;
+}
+
+/*
+ * A sweep simulates every configuration over each chunk of the trace
+ * before the next. With worker threads, each takes every nthreads-th
+ * configuration, and the main thread reads the next chunk while they
+ * simulate this one.
+ */
+struct sweep {
+    struct cache *caches;
+    int ncaches;
+    int nthreads;
+    struct trace_ref *refs;     /* the chunk being simulated */
+    int n;                      /* accesses in it; 0 tells workers to quit */
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+};
+
+struct worker {
+    struct sweep *sweep;
+    int id;
+    pthread_t tid;
+};
+
+void *sweep_worker(void *arg)
+{
+    struct worker *worker = arg;
+    struct sweep *sweep = worker->sweep;
+
+    for(;;)
+    {
+        pthread_barrier_wait(&sweep->start);
+        if(sweep->n == 0)
+        {
+            return NULL;
+        }
+        for(int k = worker->id; k < sweep->ncaches; k += sweep->nthreads)
+        {
+            simulate(&sweep->caches[k], sweep->refs, sweep->n);
+        }
+        pthread_barrier_wait(&sweep->done);
+    }
+}
+
+void run_sweep(struct cache *caches, int ncaches, trace_reader_t *reader, int nthreads)
+{
+    struct trace_ref *bufs[2];
+    int n, cur = 0;
+
+    bufs[0] = malloc(SWEEP_REFS * sizeof(struct trace_ref));
+    bufs[1] = malloc(SWEEP_REFS * sizeof(struct trace_ref));
+    if(bufs[0] == NULL || bufs[1] == NULL)
+    {
+        fprintf(stderr, "csim: out of memory for the trace chunks\n");
+        exit(1);
+    }
+
+    if(nthreads <= 1)
+    {
+        while((n = trace_read(reader, bufs[0], SWEEP_REFS)) > 0)
+        {
+            for(int k = 0; k < ncaches; k++)
             {
-                printf("%c %llx,%d", operation, address, size);
+                simulate(&caches[k], bufs[0], n);
             }
-			switch(operation) {
-				case 'I':
-					break;
-				case 'L':
-					param = run_cache(cache, param, address);
-					break;
-				case 'S':
-					param = run_cache(cache, param, address);
-					break;
-				case 'M':
-					param = run_cache(cache, param, address);
-					param = run_cache(cache, param, address);
-					break;
-				default:
-					break;
-			}
-            if(param.show && operation != 'I')
+        }
+    }
+    else
+    {
+        struct sweep sweep;
+        struct worker *workers = malloc(nthreads * sizeof(struct worker));
+
+        sweep.caches = caches;
+        sweep.ncaches = ncaches;
+        sweep.nthreads = nthreads;
+        pthread_barrier_init(&sweep.start, NULL, nthreads + 1);
+        pthread_barrier_init(&sweep.done, NULL, nthreads + 1);
+        for(int i = 0; i < nthreads; i++)
+        {
+            workers[i].sweep = &sweep;
+            workers[i].id = i;
+            if(pthread_create(&workers[i].tid, NULL, sweep_worker, &workers[i]) != 0)
             {
-                printf("\n");
+                fprintf(stderr, "csim: can't start thread %d\n", i);
+                exit(1);
             }
-		}
-	}
-    printSummary(param.hits, param.misses, param.evictions);
-    for(int i=0; i < param.S; i++)
+        }
+
+        n = trace_read(reader, bufs[cur], SWEEP_REFS);
+        for(;;)
+        {
+            sweep.refs = bufs[cur];
+            sweep.n = n;
+            pthread_barrier_wait(&sweep.start);
+            if(n == 0)
+            {
+                break;
+            }
+            n = trace_read(reader, bufs[1 - cur], SWEEP_REFS);
+            pthread_barrier_wait(&sweep.done);
+            cur = 1 - cur;
+        }
+
+        for(int i = 0; i < nthreads; i++)
+        {
+            pthread_join(workers[i].tid, NULL);
+        }
+        pthread_barrier_destroy(&sweep.start);
+        pthread_barrier_destroy(&sweep.done);
+        free(workers);
+    }
+    free(bufs[0]);
+    free(bufs[1]);
+}
+
+int main(int argc, char **argv)
+{
+    int option=0;
+    int show = 0, timing = 0, nthreads = 1, nconfigs;
+    char *s_arg = NULL, *E_arg = NULL, *b_arg = NULL, *config_arg = NULL;
+    char *file_name = NULL;
+    char *impl_name = NULL;
+    struct config *configs = malloc(MAX_CONFIGS * sizeof(struct config));
+    struct cache *caches;
+
+    while((option = getopt(argc, argv, "hvTs:E:b:t:k:c:j:"))!=EOF)
+    {
+        switch(option)
+        {
+            case 's': s_arg = optarg; break;
+            case 'E': E_arg = optarg; break;
+            case 'b': b_arg = optarg; break;
+            case 'c': config_arg = optarg; break;
+            case 't': file_name = optarg; break;
+            case 'k': impl_name = optarg; break;
+            case 'j': nthreads = atoi(optarg); break;
+            case 'h': print_usage(); return 0;
+            case 'v': show = 1; break;
+            case 'T': timing = 1; break;
+            default: print_usage(); return 1;
+        }
+    }
+    nconfigs = parse_configs(config_arg, s_arg, E_arg, b_arg, configs, MAX_CONFIGS);
+    if(nconfigs < 1 || file_name == NULL || nthreads < 1)
+    {
+        print_usage();
+        return 1;
+    }
+    if(show && nconfigs > 1)
+    {
+        fprintf(stderr, "csim: -v takes a single configuration\n");
+        return 1;
+    }
+
+    if(posix_memalign((void **) &caches, LINE_BYTES, nconfigs * sizeof(struct cache)) != 0)
+    {
+        fprintf(stderr, "csim: out of memory for %d configurations\n", nconfigs);
+        return 1;
+    }
+    for(int k = 0; k < nconfigs; k++)
+    {
+        int s = configs[k].s, E = configs[k].E, b = configs[k].b;
+        struct lru_impl *impl;
+
+        if(s < 0 || E < 1 || b < 0 || s + b >= 64)
+        {
+            fprintf(stderr, "csim: bad configuration s=%d E=%d b=%d\n", s, E, b);
+            return 1;
+        }
+        impl = find_impl(impl_name, E);
+        if(impl != NULL && E > MAX_SIMD_E && strcmp(impl->name, "scalar") != 0)
+        {
+            fprintf(stderr, "csim: -k %s takes E up to %d\n", impl_name, MAX_SIMD_E);
+            return 1;
+        }
+        if(impl == NULL)
+        {
+            fprintf(stderr, "csim: no %s implementation for this CPU\n", impl_name);
+            return 1;
+        }
+        init_cache(&caches[k], s, E, b, impl, show);
+    }
+
+    trace_reader_t *reader;
+    struct trace_ref refs[REFS];
+    int n;
+    double sim_time = 0, total_time, start = now_seconds();
+
+    reader = trace_open(file_name, 0);
+    if(nconfigs > 1)
+    {
+        run_sweep(caches, nconfigs, reader, nthreads);
+        trace_close(reader);
+        total_time = now_seconds() - start;
+        printf("%4s %6s %4s %12s %12s %12s\n", "s", "E", "b", "hits", "misses", "evictions");
+        for(int k = 0; k < nconfigs; k++)
+        {
+            printf("%4d %6d %4d %12d %12d %12d\n", caches[k].s, caches[k].E, caches[k].b,
+                   caches[k].hits, caches[k].misses, caches[k].evictions);
+        }
+        if(timing)
+        {
+            printf("csim: %llu accesses, %d configurations, %.3f s (%.1f M accesses/s per configuration)\n",
+                   caches[0].count, nconfigs, total_time,
+                   total_time > 0 ? caches[0].count / total_time / 1e6 : 0.0);
+        }
+    }
+    else
+    {
+        while ((n = trace_read(reader, refs, REFS)) > 0) {
+            double sim_start = now_seconds();
+            simulate(&caches[0], refs, n);
+            sim_time += now_seconds() - sim_start;
+        }
+        trace_close(reader);
+        total_time = now_seconds() - start;
+        printSummary(caches[0].hits, caches[0].misses, caches[0].evictions);
+        if(timing)
+        {
+            printf("csim: %llu accesses read and simulated in %.3f s (%.1f M accesses/s)\n",
+                   caches[0].count, total_time,
+                   total_time > 0 ? caches[0].count / total_time / 1e6 : 0.0);
+            printf("%s: %llu accesses simulated in %.3f s (%.1f M accesses/s)\n",
+                   caches[0].impl->name, caches[0].count, sim_time,
+                   sim_time > 0 ? caches[0].count / sim_time / 1e6 : 0.0);
+        }
+    }
+    for(int k = 0; k < nconfigs; k++)
     {
-        free(cache[i]);
+        free_cache(&caches[k]);
     }
-    free(cache);
-	return 0;
+    free(caches);
+    free(configs);
+    return 0;
 }
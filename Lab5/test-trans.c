@@ -12,6 +12,7 @@
 #include <getopt.h>
 #include <sys/types.h>
 #include "cachelab.h"
+#include "tracefile.h"
 #include <sys/wait.h> // fir WEXITSTATUS
 #include <limits.h> // for INT_MAX
 
@@ -46,17 +47,18 @@ static struct results results = {-1, 0, INT_MAX};
  */
 void eval_perf(unsigned int s, unsigned int E, unsigned int b)
 {
-    int i,flag;
-    unsigned int len, hits, misses, evictions;
+    int i,j,n,flag;
+    unsigned int hits, misses, evictions;
     unsigned long long int marker_start, marker_end, addr;
-    char buf[1000], cmd[255];
+    char cmd[255];
     char filename[128];
+    struct trace_ref refs[TRACE_BLOCK];
 
     registerFunctions(); 
 
     /* Open the complete trace file */
-    FILE* full_trace_fp;  
-    FILE* part_trace_fp; 
+    trace_reader_t *full_trace;
+    trace_writer_t *part_trace;
 
     /* Evaluate the performance of each registered transpose function */
 
@@ -89,23 +91,19 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
             results.correct = 1;
         }
 
-        full_trace_fp = fopen("trace.tmp", "r");
-        assert(full_trace_fp);
+        /* trace.tmp may be lackey text or binary (see tracefile.h) */
+        full_trace = trace_open("trace.tmp", 0);
 
-
-        /* Filtered trace for each transpose function goes in a separate file */
+        /* Filtered trace for each transpose function goes in a separate
+           file, as text, which is what csim-ref reads */
         sprintf(filename, "trace.f%d", i);
-        part_trace_fp = fopen(filename, "w");
-        assert(part_trace_fp);
+        part_trace = trace_create(filename, 0);
     
         /* Locate trace corresponding to the trans function */
         flag = 0;
-        while (fgets(buf, 1000, full_trace_fp) != NULL) {
-
-            /* We are only interested in memory access instructions */
-            if (buf[0]==' ' && buf[2]==' ' &&
-                (buf[1]=='S' || buf[1]=='M' || buf[1]=='L' )) {
-                sscanf(buf+3, "%llx,%u", &addr, &len);
+        while (flag >= 0 && (n = trace_read(full_trace, refs, TRACE_BLOCK)) > 0) {
+            for (j = 0; j < n; j++) {
+                addr = refs[j].addr;
         
                 /* If start marker found, set flag */
                 if (addr == marker_start)
@@ -120,19 +118,19 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
                    try to do more informed filtering so that would
                    eliminate the valgrind stack references while
                    include the student stack references. */
-                if (flag && addr < 0xffffffff) {
-                    fputs(buf, part_trace_fp);
+                if (flag > 0 && addr < 0xffffffff) {
+                    trace_write(part_trace, &refs[j]);
                 }
 
-                /* if end marker found, close trace file */
+                /* if end marker found, stop */
                 if (addr == marker_end) {
-                    flag = 0;
-                    fclose(part_trace_fp);
+                    flag = -1;
                     break;
                 }
             }
         }
-        fclose(full_trace_fp);
+        trace_finish(part_trace);
+        trace_close(full_trace);
 
         /* Run the reference simulator */
         printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
@@ -0,0 +1,505 @@
+/*
+ * tracefile.c - Read and write memory traces in lackey's text format
+ *     or the binary format described in tracefile.h
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "tracefile.h"
+
+/* Bytes of the trace read at a time; a binary block must fit */
+#define TRACE_BUF (1 << 20)
+
+/* Most bytes one access takes in a binary block */
+#define MAX_REF_BYTES 21
+
+#define TRACE_MAGIC "CSIMTRC1"
+#define INDEX_MAGIC "CSIMIDX1"
+#define TRAILER_BYTES 32
+
+static const char ops[] = "ILSM";
+
+/*
+ * A trace being read through a buffer of its own with read(2), so
+ * that it can come from a pipe as well as a file.
+ */
+struct trace_reader {
+    char *name;
+    int fd;
+    char *buf;
+    size_t pos;                 /* first byte of buf not yet parsed */
+    size_t len;                 /* bytes in buf */
+    int eof;
+    int instr;                  /* return 'I' accesses too */
+    int binary;
+    /* Binary traces: the block being decoded */
+    unsigned int left;          /* accesses of it not yet decoded */
+    size_t end;                 /* first byte of buf after it */
+    int ended;                  /* read the end block */
+    unsigned long long prev[2]; /* last instruction and data address */
+    /* Binary trace files: the index, read by the first trace_seek */
+    unsigned long long *index;  /* offset and first access of each block */
+    unsigned long long blocks;
+    unsigned long long refs;
+};
+
+struct trace_writer {
+    char *name;
+    FILE *fp;
+    int binary;
+    /* Binary traces: the block being written */
+    unsigned char *block;
+    size_t bytes;
+    int count;
+    unsigned long long prev[2];
+    unsigned long long offset;  /* bytes written so far */
+    unsigned long long refs;
+    unsigned long long *index;
+    unsigned long long blocks;
+    unsigned long long max_blocks;
+};
+
+/*
+ * trace_error - Report an error with a trace file and exit
+ */
+static void trace_error(char *name, char *msg)
+{
+    fprintf(stderr, "%s: %s\n", name, msg);
+    exit(1);
+}
+
+/*
+ * fill - Move the unparsed bytes to the front of the buffer and read
+ *     more after them. Sets eof at the end of the trace.
+ */
+static void fill(trace_reader_t *reader)
+{
+    ssize_t got;
+
+    memmove(reader->buf, reader->buf + reader->pos, reader->len - reader->pos);
+    reader->len -= reader->pos;
+    reader->pos = 0;
+    do {
+        got = read(reader->fd, reader->buf + reader->len, TRACE_BUF - reader->len);
+    } while (got < 0 && errno == EINTR);
+    if (got < 0)
+        trace_error(reader->name, strerror(errno));
+    if (got == 0)
+        reader->eof = 1;
+    reader->len += got;
+}
+
+static unsigned long long get_le(const unsigned char *p, int bytes)
+{
+    unsigned long long val = 0;
+    int i;
+
+    for (i = bytes - 1; i >= 0; i--)
+        val = val << 8 | p[i];
+    return val;
+}
+
+static unsigned long long get_varint(const unsigned char **pp)
+{
+    const unsigned char *p = *pp;
+    unsigned long long val = 0;
+    int shift = 0;
+
+    do {
+        val |= (unsigned long long) (*p & 0x7f) << shift;
+        shift += 7;
+    } while (*p++ & 0x80 && shift < 64);
+    *pp = p;
+    return val;
+}
+
+trace_reader_t *trace_open(char *file_name, int instr)
+{
+    trace_reader_t *reader = calloc(1, sizeof(trace_reader_t));
+
+    /* The slack lets a corrupt block's last varint run off its end */
+    if (reader == NULL || (reader->buf = malloc(TRACE_BUF + 2 * MAX_REF_BYTES)) == NULL)
+        trace_error(file_name, "out of memory");
+    reader->name = file_name;
+    reader->instr = instr;
+    if (strcmp(file_name, "-") == 0)
+        reader->fd = STDIN_FILENO;
+    else if ((reader->fd = open(file_name, O_RDONLY)) < 0)
+        trace_error(file_name, strerror(errno));
+
+    while (reader->len < strlen(TRACE_MAGIC) && !reader->eof)
+        fill(reader);
+    if (reader->len >= strlen(TRACE_MAGIC) &&
+        memcmp(reader->buf, TRACE_MAGIC, strlen(TRACE_MAGIC)) == 0) {
+        reader->binary = 1;
+        reader->pos = strlen(TRACE_MAGIC);
+    }
+    return reader;
+}
+
+int trace_is_binary(trace_reader_t *reader)
+{
+    return reader->binary;
+}
+
+void trace_close(trace_reader_t *reader)
+{
+    if (reader->fd != STDIN_FILENO)
+        close(reader->fd);
+    free(reader->index);
+    free(reader->buf);
+    free(reader);
+}
+
+static inline int hex_digit(int c)
+{
+    if ((unsigned) (c - '0') < 10)
+        return c - '0';
+    c |= 0x20;
+    if ((unsigned) (c - 'a') < 6)
+        return c - 'a' + 10;
+    return -1;
+}
+
+/*
+ * parse_ref - Parse the text line from p up to end into ref. Returns 1
+ *     for an access, 0 for anything else, such as the "==pid==" lines
+ *     valgrind writes when its output is piped in.
+ */
+static inline int parse_ref(const char *p, const char *end, struct trace_ref *ref)
+{
+    unsigned long long address = 0;
+    int size = 0;
+    int digit;
+    const char *digits;
+
+    while (p < end && *p == ' ')
+        p++;
+    if (p == end || (*p != 'I' && *p != 'L' && *p != 'S' && *p != 'M'))
+        return 0;
+    ref->op = *p++;
+    if (p == end || *p != ' ')
+        return 0;
+    while (p < end && *p == ' ')
+        p++;
+    for (digits = p; p < end && (digit = hex_digit(*p)) >= 0; p++)
+        address = address << 4 | digit;
+    if (p == digits || p == end || *p != ',')
+        return 0;
+    for (p++; p < end && (unsigned) (*p - '0') < 10; p++)
+        size = size * 10 + (*p - '0');
+    ref->addr = address;
+    ref->size = size;
+    return 1;
+}
+
+static int read_text(trace_reader_t *reader, struct trace_ref *refs, int max)
+{
+    int n = 0;
+
+    while (n < max) {
+        char *line = reader->buf + reader->pos;
+        char *end = memchr(line, '\n', reader->len - reader->pos);
+
+        if (end == NULL) {
+            if (reader->eof) {
+                /* A last line without a newline */
+                end = reader->buf + reader->len;
+                if (line == end)
+                    break;
+            }
+            else {
+                if (reader->pos == 0 && reader->len == TRACE_BUF)
+                    reader->pos = reader->len; /* no line is this long */
+                fill(reader);
+                continue;
+            }
+        }
+        if (parse_ref(line, end, &refs[n]) && (refs[n].op != 'I' || reader->instr))
+            n++;
+        reader->pos = end - reader->buf;
+        if (reader->pos < reader->len)
+            reader->pos++;
+    }
+    return n;
+}
+
+/*
+ * next_block - Get the next binary block, all of it, into the buffer
+ *     and start decoding it. Returns 0 at the end of the trace.
+ */
+static int next_block(trace_reader_t *reader)
+{
+    const unsigned char *p;
+    unsigned long long count, bytes;
+
+    if (reader->ended)
+        return 0;
+    while (reader->len - reader->pos < 8 && !reader->eof)
+        fill(reader);
+    if (reader->len - reader->pos < 8)
+        trace_error(reader->name, "binary trace ends without its end block");
+    p = (unsigned char *) reader->buf + reader->pos;
+    count = get_le(p, 4);
+    bytes = get_le(p + 4, 4);
+    if (count == 0 && bytes == 0) {
+        reader->ended = 1;
+        return 0;
+    }
+    /* Each access takes at least a byte of op and size and one of address */
+    if (count == 0 || count > TRACE_BLOCK || count * 2 > bytes ||
+        bytes > count * MAX_REF_BYTES || bytes > TRACE_BUF - 8)
+        trace_error(reader->name, "corrupt binary trace block");
+    while (reader->len - reader->pos < 8 + bytes && !reader->eof)
+        fill(reader);
+    if (reader->len - reader->pos < 8 + bytes)
+        trace_error(reader->name, "binary trace ends in the middle of a block");
+    reader->pos += 8;
+    reader->end = reader->pos + bytes;
+    reader->left = count;
+    reader->prev[0] = reader->prev[1] = 0;
+    return 1;
+}
+
+static int read_binary(trace_reader_t *reader, struct trace_ref *refs, int max)
+{
+    int n = 0;
+
+    while (n < max) {
+        const unsigned char *p;
+        unsigned long long delta;
+        int op, size, kind;
+
+        if (reader->left == 0 && !next_block(reader))
+            break;
+        p = (unsigned char *) reader->buf + reader->pos;
+        op = *p >> 6;
+        size = *p++ & 0x3f;
+        if (size == 0x3f)
+            size = get_varint(&p);
+        delta = get_varint(&p);
+        kind = op != 0;
+        reader->prev[kind] += (delta >> 1) ^ -(delta & 1);
+        reader->pos = (char *) p - reader->buf;
+        reader->left--;
+        /* The block's accesses must take exactly its bytes */
+        if (reader->pos > reader->end || (reader->left == 0 && reader->pos != reader->end))
+            trace_error(reader->name, "corrupt binary trace block");
+        if (op == 0 && !reader->instr)
+            continue;
+        refs[n].op = ops[op];
+        refs[n].addr = reader->prev[kind];
+        refs[n].size = size;
+        n++;
+    }
+    return n;
+}
+
+int trace_read(trace_reader_t *reader, struct trace_ref *refs, int max)
+{
+    if (reader->binary)
+        return read_binary(reader, refs, max);
+    return read_text(reader, refs, max);
+}
+
+/*
+ * read_index - Read the trailer and index of a binary trace file.
+ *     Returns -1 if it is not a file or has no index.
+ */
+static int read_index(trace_reader_t *reader)
+{
+    unsigned char trailer[TRAILER_BYTES];
+    unsigned char *raw;
+    unsigned long long offset, i;
+    struct stat st;
+
+    if (fstat(reader->fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size < TRAILER_BYTES ||
+        pread(reader->fd, trailer, TRAILER_BYTES, st.st_size - TRAILER_BYTES) != TRAILER_BYTES ||
+        memcmp(trailer + 24, INDEX_MAGIC, 8) != 0)
+        return -1;
+    offset = get_le(trailer, 8);
+    reader->blocks = get_le(trailer + 8, 8);
+    reader->refs = get_le(trailer + 16, 8);
+    if (reader->blocks > (unsigned long long) st.st_size / 16 ||
+        offset > (unsigned long long) st.st_size ||
+        offset + reader->blocks * 16 + TRAILER_BYTES != (unsigned long long) st.st_size)
+        return -1;
+    raw = malloc(reader->blocks * 16 + 1);
+    reader->index = malloc(reader->blocks * 2 * sizeof(unsigned long long) + 1);
+    if (raw == NULL || reader->index == NULL)
+        trace_error(reader->name, "out of memory");
+    if (pread(reader->fd, raw, reader->blocks * 16, offset) != (ssize_t) (reader->blocks * 16)) {
+        free(raw);
+        return -1;
+    }
+    for (i = 0; i < 2 * reader->blocks; i++)
+        reader->index[i] = get_le(raw + 8 * i, 8);
+    free(raw);
+    return 0;
+}
+
+int trace_seek(trace_reader_t *reader, unsigned long long ref)
+{
+    unsigned long long lo = 0, hi, skip;
+    struct trace_ref scratch[64];
+    int instr = reader->instr;
+
+    if (!reader->binary || (reader->index == NULL && read_index(reader) < 0) ||
+        ref >= reader->refs)
+        return -1;
+
+    /* The last block that starts at or before ref */
+    hi = reader->blocks;
+    while (hi - lo > 1) {
+        unsigned long long mid = (lo + hi) / 2;
+        if (reader->index[2 * mid + 1] <= ref)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if (lseek(reader->fd, reader->index[2 * lo], SEEK_SET) < 0)
+        return -1;
+    reader->pos = reader->len = 0;
+    reader->eof = reader->ended = reader->left = 0;
+
+    /* Decode up to ref, counting the 'I' accesses too */
+    reader->instr = 1;
+    for (skip = ref - reader->index[2 * lo + 1]; skip > 0; ) {
+        int n = skip < 64 ? skip : 64;
+        read_binary(reader, scratch, n);
+        skip -= n;
+    }
+    reader->instr = instr;
+    return 0;
+}
+
+trace_writer_t *trace_create(char *file_name, int binary)
+{
+    trace_writer_t *writer = calloc(1, sizeof(trace_writer_t));
+
+    if (writer == NULL)
+        trace_error(file_name, "out of memory");
+    writer->name = file_name;
+    writer->binary = binary;
+    if (strcmp(file_name, "-") == 0)
+        writer->fp = stdout;
+    else if ((writer->fp = fopen(file_name, "w")) == NULL)
+        trace_error(file_name, strerror(errno));
+    if (binary) {
+        writer->block = malloc(TRACE_BLOCK * MAX_REF_BYTES);
+        if (writer->block == NULL)
+            trace_error(file_name, "out of memory");
+        fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), writer->fp);
+        writer->offset = strlen(TRACE_MAGIC);
+    }
+    return writer;
+}
+
+static void put_le(trace_writer_t *writer, unsigned long long val, int bytes)
+{
+    int i;
+
+    for (i = 0; i < bytes; i++, val >>= 8)
+        putc(val & 0xff, writer->fp);
+    writer->offset += bytes;
+}
+
+static unsigned char *put_varint(unsigned char *p, unsigned long long val)
+{
+    while (val >= 0x80) {
+        *p++ = val | 0x80;
+        val >>= 7;
+    }
+    *p++ = val;
+    return p;
+}
+
+/*
+ * flush_block - Write out the block being built, and add it to the
+ *     index.
+ */
+static void flush_block(trace_writer_t *writer)
+{
+    if (writer->count == 0)
+        return;
+    if (writer->blocks == writer->max_blocks) {
+        writer->max_blocks = writer->max_blocks ? 2 * writer->max_blocks : 1024;
+        writer->index = realloc(writer->index, writer->max_blocks * 2 * sizeof(unsigned long long));
+        if (writer->index == NULL)
+            trace_error(writer->name, "out of memory");
+    }
+    writer->index[2 * writer->blocks] = writer->offset;
+    writer->index[2 * writer->blocks + 1] = writer->refs - writer->count;
+    writer->blocks++;
+
+    put_le(writer, writer->count, 4);
+    put_le(writer, writer->bytes, 4);
+    fwrite(writer->block, 1, writer->bytes, writer->fp);
+    writer->offset += writer->bytes;
+    writer->bytes = 0;
+    writer->count = 0;
+    writer->prev[0] = writer->prev[1] = 0;
+}
+
+void trace_write(trace_writer_t *writer, const struct trace_ref *ref)
+{
+    unsigned char *p;
+    long long delta;
+    int op, kind;
+
+    if (!writer->binary) {
+        if (ref->op == 'I')
+            fprintf(writer->fp, "I  %08llx,%d\n", ref->addr, ref->size);
+        else
+            fprintf(writer->fp, " %c %08llx,%d\n", ref->op, ref->addr, ref->size);
+        return;
+    }
+
+    op = strchr(ops, ref->op) - ops;
+    kind = op != 0;
+    p = writer->block + writer->bytes;
+    if (ref->size < 0x3f) {
+        *p++ = op << 6 | ref->size;
+    }
+    else {
+        *p++ = op << 6 | 0x3f;
+        p = put_varint(p, ref->size);
+    }
+    delta = ref->addr - writer->prev[kind];
+    p = put_varint(p, (unsigned long long) delta << 1 ^ (unsigned long long) (delta >> 63));
+    writer->prev[kind] = ref->addr;
+    writer->bytes = p - writer->block;
+    writer->refs++;
+    if (++writer->count == TRACE_BLOCK)
+        flush_block(writer);
+}
+
+void trace_finish(trace_writer_t *writer)
+{
+    unsigned long long i, index_offset;
+
+    if (writer->binary) {
+        flush_block(writer);
+        put_le(writer, 0, 4);
+        put_le(writer, 0, 4);
+        index_offset = writer->offset;
+        for (i = 0; i < 2 * writer->blocks; i++)
+            put_le(writer, writer->index[i], 8);
+        put_le(writer, index_offset, 8);
+        put_le(writer, writer->blocks, 8);
+        put_le(writer, writer->refs, 8);
+        fwrite(INDEX_MAGIC, 1, strlen(INDEX_MAGIC), writer->fp);
+    }
+    if (fflush(writer->fp) != 0 || ferror(writer->fp))
+        trace_error(writer->name, strerror(errno));
+    if (writer->fp != stdout)
+        fclose(writer->fp);
+    free(writer->block);
+    free(writer->index);
+    free(writer);
+}
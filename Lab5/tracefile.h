@@ -0,0 +1,80 @@
+/*
+ * tracefile.h - Read and write memory traces, either in valgrind
+ *     lackey's text format or in a compact binary format
+ *
+ * The text format has one access per line, "I  <addr>,<size>" for an
+ * instruction fetch and " <op> <addr>,<size>" for a load (L), store
+ * (S) or modify (M), with the address in hex. Other lines are skipped.
+ *
+ * The binary format stores about 3 bytes per access instead of 14 or
+ * so, in blocks that can each be decoded on their own:
+ *
+ *   file:    "CSIMTRC1", blocks, an end block, the index, the trailer
+ *   block:   u32 number of accesses, u32 payload bytes, payload
+ *   payload: for each access, a byte of op << 6 | size (ops I L S M
+ *            are 0..3; a size of 63 or more stores 63 and follows
+ *            with the size as a varint), then the zigzag varint of
+ *            the address minus the previous address of the same kind
+ *            (instruction or data) in the block, or minus 0 for the
+ *            first one
+ *   end:     u32 0, u32 0
+ *   index:   for each block, u64 file offset, u64 accesses before it
+ *   trailer: u64 index offset, u64 blocks, u64 accesses, "CSIMIDX1"
+ *
+ * Integers are little-endian; varints are LEB128, 7 bits a byte. The
+ * index lets trace_seek jump to any access of a binary trace file.
+ */
+#ifndef TRACEFILE_H
+#define TRACEFILE_H
+
+/* Accesses in each block of a binary trace */
+#define TRACE_BLOCK 4096
+
+/* One access: op is 'I', 'L', 'S' or 'M' */
+struct trace_ref {
+    unsigned long long addr;
+    int size;
+    char op;
+};
+
+typedef struct trace_reader trace_reader_t;
+typedef struct trace_writer trace_writer_t;
+
+/*
+ * trace_open - Open a text or binary trace ("-" for stdin); which one
+ *     it is is told from its first bytes. trace_read returns 'I'
+ *     accesses only if instr is nonzero. Exits on error.
+ */
+trace_reader_t *trace_open(char *file_name, int instr);
+
+/*
+ * trace_read - Read up to max accesses into refs. Returns how many
+ *     were read; fewer than max only at the end of the trace.
+ */
+int trace_read(trace_reader_t *reader, struct trace_ref *refs, int max);
+
+/*
+ * trace_seek - Make the next access read the one numbered ref (from
+ *     0, counting 'I' accesses) of a binary trace file. Returns 0 on
+ *     success, -1 for a text trace, a pipe, or ref past the end.
+ */
+int trace_seek(trace_reader_t *reader, unsigned long long ref);
+
+int trace_is_binary(trace_reader_t *reader);
+void trace_close(trace_reader_t *reader);
+
+/*
+ * trace_create - Start writing a trace ("-" for stdout), in the binary
+ *     format if binary is nonzero, else as lackey text. The binary
+ *     format needs no seeking, so it can go to a pipe. Exits on error.
+ */
+trace_writer_t *trace_create(char *file_name, int binary);
+void trace_write(trace_writer_t *writer, const struct trace_ref *ref);
+
+/*
+ * trace_finish - Write what is left (for the binary format, the last
+ *     block, the index and the trailer) and close the trace.
+ */
+void trace_finish(trace_writer_t *writer);
+
+#endif /* TRACEFILE_H */
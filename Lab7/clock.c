@@ -1,5 +1,5 @@
 /* 
- * clock.c - Routines for using the cycle counters on x86, 
+ * clock.c - Routines for using the cycle counters on x86, x86-64,
  *           Alpha, and Sparc boxes.
  * 
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
@@ -9,9 +9,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/times.h>
 #include "clock.h"
 
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
 
 /******************************************************* 
  * Machine dependent functions 
@@ -21,51 +26,31 @@
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
- * Pentium versions of start_counter() and get_counter()
+ * x86 and x86-64 versions of start_counter() and get_counter()
  *******************************************************/
 
 
 /* $begin x86cyclecounter */
 /* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
-
-
-/* Set *hi and *lo to the high and low order bits  of the cycle counter.  
-   Implementation requires assembly code to use the rdtsc instruction. */
-void access_counter(unsigned *hi, unsigned *lo)
-{
-    asm("rdtsc; movl %%edx,%0; movl %%eax,%1"   /* Read cycle counter */
-	: "=r" (*hi), "=r" (*lo)                /* and move results to */
-	: /* No input */                        /* the two outputs */
-	: "%edx", "%eax");
-}
+static unsigned long long cyc_start = 0;
 
 /* Record the current value of the cycle counter. */
 void start_counter()
 {
-    access_counter(&cyc_hi, &cyc_lo);
+    cyc_start = tsc_start();
 }
 
 /* Return the number of cycles since the last call to start_counter. */
 double get_counter()
 {
-    unsigned ncyc_hi, ncyc_lo;
-    unsigned hi, lo, borrow;
+    unsigned long long now = tsc_stop();
     double result;
 
-    /* Get cycle counter */
-    access_counter(&ncyc_hi, &ncyc_lo);
-
-    /* Do double precision subtraction */
-    lo = ncyc_lo - cyc_lo;
-    borrow = lo > ncyc_lo;
-    hi = ncyc_hi - cyc_hi - borrow;
-    result = (double) hi * (1 << 30) * 4 + lo;
-    if (result < 0) {
-	fprintf(stderr, "Error: counter returns neg value: %.0f\n", result);
+    result = (double) (now - cyc_start);
+    if (now < cyc_start) {
+	fprintf(stderr, "Error: counter returns neg value: %.0f\n", -result);
     }
     return result;
 }
@@ -163,6 +148,148 @@ double get_counter()
 
 
 
+/*******************************************************
+ * Invariant TSC routines. The TSC ticks at a constant rate no
+ * matter what the core clock is doing, so once we know that rate
+ * it is a cheap, high-resolution wall clock. We read it with
+ * fences on both sides so that the timed code can't leak out of
+ * the measured interval.
+ *******************************************************/
+
+#if defined(__i386__) || defined(__x86_64__)
+
+static int has_rdtscp = -1;  /* does the CPU have rdtscp? (-1 = unknown) */
+
+/* Check the CPUID feature bits for rdtscp */
+static void check_rdtscp(void)
+{
+    unsigned eax, ebx, ecx, edx;
+
+    has_rdtscp = __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) && 
+	(edx & (1 << 27));
+}
+
+/* Read the TSC at the start of an interval: no earlier instruction
+   may still be running, and no later one may start early */
+unsigned long long tsc_start(void)
+{
+    unsigned lo, hi;
+
+    asm volatile("lfence; rdtsc; lfence" 
+		 : "=a" (lo), "=d" (hi) : : "memory");
+    return ((unsigned long long) hi << 32) | lo;
+}
+
+/* Read the TSC at the end of an interval: rdtscp waits for all 
+   earlier instructions, and the lfence holds back later ones */
+unsigned long long tsc_stop(void)
+{
+    unsigned lo, hi, aux;
+
+    if (has_rdtscp < 0)
+	check_rdtscp();
+    if (has_rdtscp)
+	asm volatile("rdtscp; lfence" 
+		     : "=a" (lo), "=d" (hi), "=c" (aux) : : "memory");
+    else
+	asm volatile("lfence; rdtsc; lfence" 
+		     : "=a" (lo), "=d" (hi) : : "memory");
+    return ((unsigned long long) hi << 32) | lo;
+}
+
+/* Return the TSC rate in MHz as reported by CPUID or the kernel, or 0 */
+static double tsc_reported_mhz(void)
+{
+    unsigned eax, ebx, ecx, edx;
+    unsigned khz;
+    FILE *fp;
+
+    /* Leaf 0x15: TSC = crystal clock * ebx/eax */
+    if (__get_cpuid_max(0, NULL) >= 0x15) {
+	__cpuid_count(0x15, 0, eax, ebx, ecx, edx);
+	if (eax && ebx && ecx)
+	    return (double) ecx * ebx / eax / 1e6;
+    }
+
+    /* Some kernels export the frequency they calibrated at boot */
+    if ((fp = fopen("/sys/devices/system/cpu/cpu0/tsc_freq_khz", "r"))) {
+	if (fscanf(fp, "%u", &khz) == 1 && khz > 0) {
+	    fclose(fp);
+	    return khz / 1e3;
+	}
+	fclose(fp);
+    }
+    return 0;
+}
+
+/* Measure the TSC rate against CLOCK_MONOTONIC_RAW over about 10 ms */
+static double tsc_calibrate_mhz(void)
+{
+    struct timespec t0, t1;
+    unsigned long long c0, c1;
+    double ns;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+    c0 = tsc_start();
+    do {
+	clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+	ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    } while (ns < 1e7);
+    c1 = tsc_stop();
+    return (c1 - c0) / ns * 1e3;
+}
+
+/* 
+ * tsc_mhz - Return the rate of the invariant TSC in MHz, or 0 if the 
+ *     TSC isn't invariant and so can't be used as a clock
+ */
+double tsc_mhz(int verbose)
+{
+    static double rate = -1;
+    unsigned eax, ebx, ecx, edx;
+
+    if (rate >= 0)
+	return rate;
+
+    rate = 0;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || 
+	!(edx & (1 << 8))) {
+	if (verbose)
+	    printf("TSC is not invariant\n");
+	return rate;
+    }
+    if ((rate = tsc_reported_mhz()) > 0) {
+	if (verbose)
+	    printf("Invariant TSC rate = %.1f MHz (reported)\n", rate);
+    }
+    else {
+	rate = tsc_calibrate_mhz();
+	if (verbose)
+	    printf("Invariant TSC rate ~= %.1f MHz (calibrated)\n", rate);
+    }
+    return rate;
+}
+
+#else
+
+/* No TSC on this platform */
+unsigned long long tsc_start(void)
+{
+    return 0;
+}
+
+unsigned long long tsc_stop(void)
+{
+    return 0;
+}
+
+double tsc_mhz(int verbose)
+{
+    return 0;
+}
+
+#endif
+
 /*******************************
  * Machine-independent functions
  ******************************/
@@ -195,9 +322,16 @@ double mhz_full(int verbose, int sleeptime)
 }
 /* $end mhz */
 
-/* Version using a default sleeptime */
+/* Version that asks the TSC first, and only sleeps if it has to */
 double mhz(int verbose)
 {
+    double rate = tsc_mhz(0);
+
+    if (rate > 0) {
+	if (verbose) 
+	    printf("Processor clock rate ~= %.1f MHz\n", rate);
+	return rate;
+    }
     return mhz_full(verbose, 2);
 }
 
@@ -9,12 +9,19 @@ double get_counter();
 /* Measure overhead for counter */
 double ovhd();
 
-/* Determine clock rate of processor (using a default sleeptime) */
+/* Determine clock rate of processor (from the TSC, or using a default sleeptime) */
 double mhz(int verbose);
 
 /* Determine clock rate of processor, having more control over accuracy */
 double mhz_full(int verbose, int sleeptime);
 
+/* Read the TSC with serializing fences, at the start or end of an interval */
+unsigned long long tsc_start(void);
+unsigned long long tsc_stop(void);
+
+/* Rate of the invariant TSC in MHz, or 0 if there isn't one (no sleeping) */
+double tsc_mhz(int verbose);
+
 /** Special counters that compensate for timer interrupt overhead */
 
 void start_comp_counter();
@@ -62,11 +62,20 @@
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/* 
+ * Where mem_init_file maps a file-backed heap. A heap file can only be
+ * reopened at the address it was made at, since the blocks in it
+ * point at each other.
+ */
+#define HEAP_FILE_BASE 0x50000000
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#define USE_TSC    0   /* invariant TSC, else CLOCK_MONOTONIC_RAW (any Unix box) */
+#define USE_FBENCH 1   /* USE_TSC sampled until the 95% CI converges */
 
 #endif /* __CONFIG_H */
@@ -0,0 +1,312 @@
+/*
+ * fbench.c - Estimate the time (in seconds) used by a function f, with
+ *     a confidence interval
+ *
+ * Unlike the K-best scheme in fcyc.c, which reports the fastest few
+ * runs, and ftimer.c, which averages a fixed number of runs, fbench
+ * keeps sampling until the 95% confidence interval of the mean is
+ * narrow enough. Each sample is one run of f, timed with ftimer_tsc.
+ * Before the statistics are computed, samples further than OUTLIER_MADS
+ * median absolute deviations from the median are thrown out. They
+ * are almost always interrupts or other processes, not f.
+ */
+#define _GNU_SOURCE  /* for sched_setaffinity() and sched_getcpu() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+
+#include "fbench.h"
+#include "ftimer.h"
+#include "fcyc.h"
+
+/* Default values */
+#define CPU -1              /* CPU to pin to (-1: wherever we are) */
+#define PIN 1               /* Pin to that CPU at all */
+#define WARMUP 2            /* Untimed runs before sampling */
+#define MIN_SAMPLES 5       /* Take at least this many samples... */
+#define MAX_SAMPLES 100     /* ...and at most this many */
+#define PRECISION 0.01      /* Target CI half-width, relative to mean */
+#define MAX_TIME 2.0        /* Give up converging after MAX_TIME secs */
+#define OUTLIER_MADS 5.0    /* Outlier cutoff, in (scaled) MADs */
+#define CLEAR_CACHE 0       /* Clear the cache before each sample */
+
+static int cpu = CPU;
+static int pin = PIN;
+static int warmup = WARMUP;
+static int min_samples = MIN_SAMPLES;
+static int max_samples = MAX_SAMPLES;
+static double precision = PRECISION;
+static double max_time = MAX_TIME;
+static int clear = CLEAR_CACHE;
+
+/*
+ * t_critical - Two-sided 95% critical value of Student's t
+ *     distribution with df degrees of freedom
+ */
+static double t_critical(int df)
+{
+    static double table[30] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+
+    if (df < 1)
+	df = 1;
+    return (df <= 30) ? table[df-1] : 1.96;
+}
+
+/* cmp_double - qsort comparison function for doubles */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* median - Return the median of the n sorted values in v */
+static double median(double *v, int n)
+{
+    return (n % 2) ? v[n/2] : (v[n/2 - 1] + v[n/2]) / 2;
+}
+
+/*
+ * summarize - Reject the outliers among the n samples and compute the
+ *     statistics of the rest. Scratch must hold n doubles.
+ */
+static void summarize(double *samples, int n, double *scratch, fbench_t *r)
+{
+    double med, mad, x, sum = 0, sumsq = 0;
+    int i, kept = 0;
+
+    memcpy(scratch, samples, n * sizeof(double));
+    qsort(scratch, n, sizeof(double), cmp_double);
+    med = median(scratch, n);
+    for (i = 0; i < n; i++)
+	scratch[i] = fabs(samples[i] - med);
+    qsort(scratch, n, sizeof(double), cmp_double);
+    mad = 1.4826 * median(scratch, n);  /* estimates sd for normal data */
+
+    for (i = 0; i < n; i++) {
+	x = samples[i];
+	if (mad > 0 && fabs(x - med) > OUTLIER_MADS * mad)
+	    continue;
+	scratch[kept++] = x;
+	sum += x;
+	sumsq += x * x;
+    }
+    qsort(scratch, kept, sizeof(double), cmp_double);
+
+    r->samples = kept;
+    r->outliers = n - kept;
+    r->median = median(scratch, kept);
+    r->mean = sum / kept;
+    r->sd = 0;
+    if (kept > 1 && sumsq > sum * r->mean)
+	r->sd = sqrt((sumsq - sum * r->mean) / (kept - 1));
+    r->ci95 = (kept > 1) ? t_critical(kept - 1) * r->sd / sqrt(kept) : 0;
+}
+
+/*
+ * fbench_summarize - Compute the statistics of n samples that were 
+ *     taken some other way
+ */
+void fbench_summarize(double *samples, int n, fbench_t *result)
+{
+    double *scratch;
+
+    memset(result, 0, sizeof(*result));
+    if (n < 1)
+	return;
+    if ((scratch = (double *)malloc(n * sizeof(double))) == NULL) {
+	fprintf(stderr, "Fatal error.  Malloc returned null in fbench\n");
+	exit(1);
+    }
+    summarize(samples, n, scratch, result);
+    free(scratch);
+}
+
+/* has_converged - Is the CI of the mean narrow enough yet? */
+static int has_converged(fbench_t *r)
+{
+    return r->samples >= min_samples && r->ci95 <= precision * r->mean;
+}
+
+/*
+ * pin_cpu - Keep the process on one CPU while it is being measured,
+ *     so that migrations don't show up in the samples. Saves the old
+ *     mask in saved and returns 1 if it changed it, else 0.
+ */
+static int pin_cpu(cpu_set_t *saved)
+{
+    cpu_set_t set;
+    int target = (cpu >= 0) ? cpu : sched_getcpu();
+
+    if (target < 0 || sched_getaffinity(0, sizeof(*saved), saved) < 0)
+	return 0;
+    CPU_ZERO(&set);
+    CPU_SET(target, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+	if (cpu >= 0)
+	    fprintf(stderr, "Warning: could not pin to cpu %d\n", cpu);
+	return 0;
+    }
+    return 1;
+}
+
+/*
+ * sample - Time one run of f(argp), from a cold cache if requested
+ */
+static double sample(fbench_funct f, void *argp)
+{
+    if (clear)
+	clear_caches();
+    return ftimer_tsc(f, argp, 1);
+}
+
+/*
+ * fbench - Sample f(argp) until its mean has converged
+ */
+void fbench(fbench_funct f, void *argp, fbench_t *result)
+{
+    fbench_t dummy;
+
+    fbench_ab(f, argp, NULL, NULL, result, &dummy);
+}
+
+/*
+ * fbench_ab - Sample fa(arga) and, if fb isn't NULL, fb(argb) in
+ *     alternating ABBA order until both means have converged
+ */
+void fbench_ab(fbench_funct fa, void *arga, fbench_funct fb, void *argb,
+	       fbench_t *ra, fbench_t *rb)
+{
+    double *sa, *sb, *scratch;
+    double elapsed = 0;
+    int n, i, pinned = 0;
+    cpu_set_t saved;
+
+    if (pin)
+	pinned = pin_cpu(&saved);
+    sa = (double *)malloc(max_samples * sizeof(double));
+    sb = (double *)malloc(max_samples * sizeof(double));
+    scratch = (double *)malloc(max_samples * sizeof(double));
+    if (!sa || !sb || !scratch) {
+	fprintf(stderr, "Fatal error.  Malloc returned null in fbench\n");
+	exit(1);
+    }
+    memset(ra, 0, sizeof(*ra));
+    memset(rb, 0, sizeof(*rb));
+
+    for (i = 0; i < warmup; i++) {
+	fa(arga);
+	if (fb)
+	    fb(argb);
+    }
+
+    for (n = 0; n < max_samples; ) {
+	/* A then B on even rounds, B then A on odd ones */
+	if (fb && (n % 2)) {
+	    elapsed += (sb[n] = sample(fb, argb));
+	    elapsed += (sa[n] = sample(fa, arga));
+	}
+	else {
+	    elapsed += (sa[n] = sample(fa, arga));
+	    if (fb)
+		elapsed += (sb[n] = sample(fb, argb));
+	}
+	n++;
+
+	if (n < min_samples)
+	    continue;
+	summarize(sa, n, scratch, ra);
+	if (fb)
+	    summarize(sb, n, scratch, rb);
+	if (has_converged(ra) && (!fb || has_converged(rb)))
+	    break;
+	if (elapsed > max_time)
+	    break;
+    }
+#ifdef DEBUG
+    printf("fbench: %d samples in %.3f secs, mean %g +- %g\n",
+	   n, elapsed, ra->mean, ra->ci95);
+#endif
+
+    free(sa);
+    free(sb);
+    free(scratch);
+    if (pinned)
+	sched_setaffinity(0, sizeof(saved), &saved);
+}
+
+
+/*************************************************************
+ * Set the various parameters used by the measurement routines
+ ************************************************************/
+
+/*
+ * set_fbench_cpu - CPU to pin the process to while measuring
+ *     Default = -1 (the CPU we are on)
+ */
+void set_fbench_cpu(int cpu_arg)
+{
+    cpu = cpu_arg;
+}
+
+/*
+ * set_fbench_pin - When clear, don't pin at all, so that threads the
+ *     test function starts can run on every CPU
+ *     Default = 1
+ */
+void set_fbench_pin(int pin_arg)
+{
+    pin = pin_arg;
+}
+
+/*
+ * set_fbench_warmup - Number of untimed runs before sampling
+ *     Default = 2
+ */
+void set_fbench_warmup(int n)
+{
+    warmup = n;
+}
+
+/*
+ * set_fbench_clear_cache - When set, clear the cache (with the 
+ *     clear_caches routine in fcyc.c) before each sample
+ *     Default = 0
+ */
+void set_fbench_clear_cache(int clear_arg)
+{
+    clear = clear_arg;
+}
+
+/*
+ * set_fbench_samples - Minimum and maximum number of samples
+ *     Default = 5, 100
+ */
+void set_fbench_samples(int min, int max)
+{
+    min_samples = (min < 2) ? 2 : min;
+    max_samples = (max < min_samples) ? min_samples : max;
+}
+
+/*
+ * set_fbench_precision - Target CI half-width, relative to the mean
+ *     Default = 0.01
+ */
+void set_fbench_precision(double precision_arg)
+{
+    precision = precision_arg;
+}
+
+/*
+ * set_fbench_max_time - Seconds of sampling before giving up
+ *     Default = 2.0
+ */
+void set_fbench_max_time(double secs)
+{
+    max_time = secs;
+}
@@ -0,0 +1,87 @@
+/*
+ * fbench.h - prototypes for the routines in fbench.c that estimate the
+ *     running time (in seconds) of a test function f with confidence
+ *     intervals, and that compare two test functions
+ */
+#ifndef __FBENCH_H_
+#define __FBENCH_H_
+
+/* The test function takes a generic pointer as input */
+typedef void (*fbench_funct)(void *);
+
+/* The summary statistics of one measurement, all in seconds */
+typedef struct {
+    int samples;    /* number of samples kept */
+    int outliers;   /* number of samples rejected as outliers */
+    double median;  /* median of the kept samples */
+    double mean;    /* mean of the kept samples */
+    double sd;      /* standard deviation of the kept samples */
+    double ci95;    /* half-width of the 95% confidence interval of the mean */
+} fbench_t;
+
+/* Measure f(argp) until its mean is known to the requested precision */
+void fbench(fbench_funct f, void *argp, fbench_t *result);
+
+/*
+ * Measure fa(arga) and fb(argb) in interleaved trials (ABBA order), so
+ * that drift in the machine's speed hits both of them equally
+ */
+void fbench_ab(fbench_funct fa, void *arga, fbench_funct fb, void *argb,
+	       fbench_t *ra, fbench_t *rb);
+
+/* Compute the statistics of n samples that were taken some other way */
+void fbench_summarize(double *samples, int n, fbench_t *result);
+
+/*********************************************************
+ * Set the various parameters used by measurement routines
+ *********************************************************/
+
+/*
+ * set_fbench_cpu - CPU to pin the process to while measuring, or -1
+ *     to stay on whichever CPU the process is running on when the
+ *     first measurement starts
+ *     Default = -1
+ */
+void set_fbench_cpu(int cpu);
+
+/*
+ * set_fbench_pin - When clear, don't pin to a CPU at all, for test
+ *     functions that start threads (which would inherit the pinning)
+ *     Default = 1
+ */
+void set_fbench_pin(int pin);
+
+/*
+ * set_fbench_warmup - Number of untimed runs before sampling
+ *     Default = 2
+ */
+void set_fbench_warmup(int n);
+
+/*
+ * set_fbench_clear_cache - When set, clear the cache (with the 
+ *     clear_caches routine in fcyc.c) before each sample
+ *     Default = 0
+ */
+void set_fbench_clear_cache(int clear);
+
+/*
+ * set_fbench_samples - Minimum and maximum number of samples
+ *     Default = 5, 100
+ */
+void set_fbench_samples(int min, int max);
+
+/*
+ * set_fbench_precision - Stop once the 95% confidence interval of the
+ *     mean is within this fraction of the mean
+ *     Default = 0.01
+ */
+void set_fbench_precision(double precision);
+
+/*
+ * set_fbench_max_time - Stop after the minimum number of samples once
+ *     this many seconds have been spent sampling, converged or not
+ *     Default = 2.0
+ */
+void set_fbench_max_time(double secs);
+
+#endif /* __FBENCH_H_ */
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <sys/times.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "fcyc.h"
 #include "clock.h"
@@ -20,8 +21,9 @@
 #define EPSILON 0.01         /* K samples should be EPSILON of each other*/
 #define COMPENSATE 0         /* 1-> try to compensate for clock ticks */
 #define CLEAR_CACHE 0        /* Clear cache before running test function */
-#define CACHE_BYTES (1<<19)  /* Max cache size in bytes */
-#define CACHE_BLOCK 32       /* Cache block size in bytes */
+#define CACHE_BYTES 0        /* Sweep size in bytes (0: from the LLC size) */
+#define CACHE_BLOCK 0        /* Cache block size in bytes (0: from sysfs) */
+#define MAX_CACHE_BYTES (1<<28) /* Never sweep more than this */
 
 static int kbest = K;
 static int maxsamples = MAXSAMPLES;
@@ -32,6 +34,9 @@ static int cache_bytes = CACHE_BYTES;
 static int cache_block = CACHE_BLOCK;
 
 static int *cache_buf = NULL;
+static cacheinfo_t cache_info;          /* filled in by find_caches() */
+static int found_caches = 0;
+static void (*clear_hook)(void) = NULL; /* called at the end of clear_caches */
 
 static double *values = NULL;
 static int samplecount = 0;
@@ -97,30 +102,180 @@ static int has_converged()
 	((1 + epsilon)*values[0] >= values[kbest-1]);
 }
 
+/*
+ * read_sysfs - Read the first line of a sysfs file into buf. Returns 0
+ *     if the file can't be read.
+ */
+static int read_sysfs(char *path, char *buf, int size)
+{
+    FILE *fp;
+    int ok;
+
+    if ((fp = fopen(path, "r")) == NULL)
+	return 0;
+    ok = (fgets(buf, size, fp) != NULL);
+    fclose(fp);
+    return ok;
+}
+
+/*
+ * find_caches - Find the sizes of the data caches and the line size
+ *     of CPU 0 in /sys/devices/system/cpu/cpu0/cache/index<n>. Each 
+ *     index<n> directory describes one cache: its level, its type 
+ *     (Data, Instruction or Unified), its size (e.g. "48K") and its
+ *     coherency_line_size (and, for L1, ways_of_associativity).
+ *     Anything we can't find stays 0.
+ */
+static void find_caches()
+{
+    char path[128], buf[64], *end;
+    int i, level;
+    long size;
+
+    found_caches = 1;
+    memset(&cache_info, 0, sizeof(cache_info));
+    for (i = 0; i < 16; i++) {
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+	if (!read_sysfs(path, buf, sizeof(buf)))
+	    break;
+	if (!strncmp(buf, "Instruction", 11))
+	    continue;
+
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+	if (!read_sysfs(path, buf, sizeof(buf)))
+	    continue;
+	level = atoi(buf);
+
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+	if (!read_sysfs(path, buf, sizeof(buf)))
+	    continue;
+	size = strtol(buf, &end, 10);
+	if (*end == 'K')
+	    size <<= 10;
+	else if (*end == 'M')
+	    size <<= 20;
+	else if (*end == 'G')
+	    size <<= 30;
+
+	if (level == 1) {
+	    cache_info.l1d = size;
+	    sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/"
+		    "ways_of_associativity", i);
+	    if (read_sysfs(path, buf, sizeof(buf)))
+		cache_info.l1d_ways = atoi(buf);
+	}
+	else if (level == 2)
+	    cache_info.l2 = size;
+	if (level >= 2 && size > cache_info.llc)
+	    cache_info.llc = size;
+
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/"
+		"coherency_line_size", i);
+	if (read_sysfs(path, buf, sizeof(buf)) && cache_info.line == 0)
+	    cache_info.line = atoi(buf);
+    }
+}
+
+/*
+ * get_cache_info - Return the cache sizes found in sysfs 
+ */
+void get_cache_info(cacheinfo_t *info)
+{
+    if (!found_caches)
+	find_caches();
+    *info = cache_info;
+}
+
+/*
+ * cache_sweep_bytes - Return the number of bytes that clear_caches
+ *     sweeps: half again the size of the last level cache (caches 
+ *     with hashed sets or adaptive replacement keep some lines through
+ *     a sweep of exactly their size), up to MAX_CACHE_BYTES
+ */
+long cache_sweep_bytes()
+{
+    long bytes;
+
+    if (cache_bytes > 0)
+	return cache_bytes;
+    if (!found_caches)
+	find_caches();
+    if (cache_info.llc == 0)
+	return 1<<22;  /* no sysfs: assume a 4MB cache or smaller */
+    bytes = cache_info.llc + cache_info.llc/2;
+    return (bytes > MAX_CACHE_BYTES) ? MAX_CACHE_BYTES : bytes;
+}
+
+/*
+ * line_bytes - Return the cache line size to sweep and flush with
+ */
+static int line_bytes()
+{
+    if (cache_block > 0)
+	return cache_block;
+    if (!found_caches)
+	find_caches();
+    return (cache_info.line > 0) ? cache_info.line : 64;
+}
+
 /* 
- * clear - Code to clear cache 
+ * clear_caches - Code to clear cache: read one word from every line of
+ *     a buffer bigger than the last level cache, which evicts (and
+ *     writes back) everything else, then call the clear hook so that
+ *     the caller can flush the memory it cares about with clflush.
+ *     Reading rather than writing leaves the sweep buffer's lines 
+ *     clean, so evicting them later costs the test function nothing.
  */
 static volatile int sink = 0;
 
-static void clear()
+void clear_caches()
 {
     int x = sink;
-    int *cptr, *cend;
-    int incr = cache_block/sizeof(int);
+    char *cptr, *cend;
+    int incr = line_bytes();
+    long bytes = cache_sweep_bytes();
+    static long buf_bytes = 0;
+
+    if (cache_buf && buf_bytes != bytes) {
+	free(cache_buf);
+	cache_buf = NULL;
+    }
     if (!cache_buf) {
-	cache_buf = malloc(cache_bytes);
+	cache_buf = malloc(bytes);
 	if (!cache_buf) {
 	    fprintf(stderr, "Fatal error.  Malloc returned null when trying to clear cache\n");
 	    exit(1);
 	}
+	memset(cache_buf, 1, bytes); /* fault in real pages, not the zero page */
+	buf_bytes = bytes;
     }
-    cptr = (int *) cache_buf;
-    cend = cptr + cache_bytes/sizeof(int);
+    cptr = (char *) cache_buf;
+    cend = cptr + bytes;
     while (cptr < cend) {
-	x += *cptr;
+	x += *(int *)cptr;
 	cptr += incr;
     }
     sink = x;
+    if (clear_hook)
+	clear_hook();
+}
+
+/*
+ * flush_cache_range - Write back and evict every cache line of
+ *     [p, p+bytes) from all levels of the cache. Only x86 has an
+ *     unprivileged instruction for this, elsewhere it does nothing.
+ */
+void flush_cache_range(void *p, long bytes)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    char *cptr = (char *)((unsigned long)p & ~(unsigned long)(line_bytes()-1));
+    char *cend = (char *)p + bytes;
+    int incr = line_bytes();
+
+    for (; cptr < cend; cptr += incr)
+	asm volatile("clflush %0" : "+m" (*(volatile char *)cptr));
+    asm volatile("mfence" ::: "memory");
+#endif
 }
 
 /*
@@ -134,7 +289,7 @@ double fcyc(test_funct f, void *argp)
 	do {
 	    double cyc;
 	    if (clear_cache)
-		clear();
+		clear_caches();
 	    start_comp_counter();
 	    f(argp);
 	    cyc = get_comp_counter();
@@ -144,7 +299,7 @@ double fcyc(test_funct f, void *argp)
 	do {
 	    double cyc;
 	    if (clear_cache)
-		clear();
+		clear_caches();
 	    start_counter();
 	    f(argp);
 	    cyc = get_counter();
@@ -184,28 +339,32 @@ void set_fcyc_clear_cache(int clear)
 
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = 0 (1.5 times the last level cache, up to 256MB)
  */
 void set_fcyc_cache_size(int bytes)
 {
-    if (bytes != cache_bytes) {
-	cache_bytes = bytes;
-	if (cache_buf) {
-	    free(cache_buf);
-	    cache_buf = NULL;
-	}
-    }
+    cache_bytes = bytes;
 }
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = 0 (the line size in sysfs, or 64)
  */
 void set_fcyc_cache_block(int bytes) {
     cache_block = bytes;
 }
 
 
+/*
+ * set_clear_cache_hook - Function that clear_caches calls after its
+ *     sweep, e.g. to flush a particular buffer with flush_cache_range
+ *     Default = NULL
+ */
+void set_clear_cache_hook(void (*hook)(void))
+{
+    clear_hook = hook;
+}
+
 /* 
  * set_fcyc_compensate- When set, will attempt to compensate for 
  *     timer interrupt overhead 
@@ -13,6 +13,27 @@ typedef void (*test_funct)(void *);
 /* Compute number of cycles used by test function f */
 double fcyc(test_funct f, void* argp);
 
+/* The data caches of CPU 0 as listed in sysfs, in bytes (0 if unknown) */
+typedef struct {
+    long l1d;   /* L1 data cache */
+    long l2;    /* L2 cache */
+    long llc;   /* last level cache */
+    int line;   /* cache line size */
+    int l1d_ways; /* L1 data cache associativity */
+} cacheinfo_t;
+
+/* Look up the cache sizes */
+void get_cache_info(cacheinfo_t *info);
+
+/* Evict everything from the caches (what fcyc does between samples) */
+void clear_caches(void);
+
+/* Number of bytes that clear_caches sweeps */
+long cache_sweep_bytes(void);
+
+/* Flush one range of memory from the caches (x86 only) */
+void flush_cache_range(void *p, long bytes);
+
 /*********************************************************
  * Set the various parameters used by measurement routines 
  *********************************************************/
@@ -26,16 +47,23 @@ void set_fcyc_clear_cache(int clear);
 
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = 0 (1.5 times the last level cache, up to 256MB)
  */
 void set_fcyc_cache_size(int bytes);
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = 0 (the line size in sysfs, or 64)
  */
 void set_fcyc_cache_block(int bytes);
 
+/*
+ * set_clear_cache_hook - Function that clear_caches calls after its
+ *     sweep, e.g. to flush a particular buffer with flush_cache_range
+ *     Default = NULL
+ */
+void set_clear_cache_hook(void (*hook)(void));
+
 /* 
  * set_fcyc_compensate- When set, will attempt to compensate for 
  *     timer interrupt overhead 
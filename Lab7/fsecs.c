@@ -6,9 +6,12 @@
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
+#include "fbench.h"
 #include "config.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
+static int samples = 1; /* fsecs samples taken by fsecs_stats */
+static int cold = 0;    /* if set, clear the cache before each run */
 
 extern int verbose; /* -v option in mdriver.c */
 
@@ -36,9 +39,39 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_FBENCH
+    if (verbose)
+	printf("Measuring performance with confidence intervals (fbench).\n");
+#elif USE_TSC
+    /* No sleeping here: the rate comes from CPUID or the kernel */
+    Mhz = tsc_mhz(verbose > 1);
+    if (verbose && Mhz > 0)
+	printf("Measuring performance with the invariant TSC (%.1f MHz).\n",
+	       Mhz);
+    else if (verbose)
+	printf("Measuring performance with clock_gettime(CLOCK_MONOTONIC_RAW).\n");
 #endif
 }
 
+#if USE_ITIMER || USE_GETTOD || USE_TSC
+/*
+ * ftimer_cold - Return the average running time of n runs of f with 
+ *     the ftimer routine timer, clearing the cache before each one
+ */
+static double ftimer_cold(double (*timer)(ftimer_test_funct, void *, int),
+			  fsecs_test_funct f, void *argp, int n)
+{
+    double secs = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+	clear_caches();
+	secs += timer(f, argp, 1);
+    }
+    return secs / n;
+}
+#endif
+
 /*
  * fsecs - Return the running time of a function f (in seconds)
  */
@@ -48,10 +81,99 @@ double fsecs(fsecs_test_funct f, void *argp)
     double cycles = fcyc(f, argp);
     return cycles/(Mhz*1e6);
 #elif USE_ITIMER
+    if (cold)
+	return ftimer_cold(ftimer_itimer, f, argp, 10);
     return ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
+    if (cold)
+	return ftimer_cold(ftimer_gettod, f, argp, 10);
     return ftimer_gettod(f, argp, 10);
+#elif USE_FBENCH
+    fbench_t result;
+
+    fbench(f, argp, &result);
+    return result.mean;
+#elif USE_TSC
+    if (cold)
+	return ftimer_cold(ftimer_tsc, f, argp, 10);
+    return ftimer_tsc(f, argp, 10);
 #endif 
 }
 
+/*
+ * fsecs_stats - Return the running time of f with its spread. fbench
+ *     samples until the mean converges, taking at least the number 
+ *     of samples set by set_fsecs_samples. The other methods just 
+ *     call fsecs that many times.
+ */
+void fsecs_stats(fsecs_test_funct f, void *argp, fbench_t *result)
+{
+#if USE_FBENCH
+    fbench(f, argp, result);
+#else
+    double x[samples];
+    int i;
+
+    for (i = 0; i < samples; i++)
+	x[i] = fsecs(f, argp);
+    fbench_summarize(x, samples, result);
+#endif
+}
+
+/*
+ * fsecs_ab - Return the running times of fa and fb. fbench runs them
+ *     in interleaved trials, the other methods one after the other.
+ */
+void fsecs_ab(fsecs_test_funct fa, void *arga, fsecs_test_funct fb, 
+	      void *argb, fbench_t *ra, fbench_t *rb)
+{
+#if USE_FBENCH
+    fbench_ab(fa, arga, fb, argb, ra, rb);
+#else
+    fsecs_stats(fa, arga, ra);
+    fsecs_stats(fb, argb, rb);
+#endif
+}
+
+/*
+ * set_fsecs_cold - When set, every timed run starts with a cold cache
+ *     (see clear_caches in fcyc.c). Otherwise, it starts with whatever
+ *     the previous run left in the cache; fbench's untimed warmup
+ *     runs and fcyc's K-best scheme keep the very first (cold) run
+ *     from counting.
+ */
+void set_fsecs_cold(int cold_arg)
+{
+    cold = cold_arg;
+#if USE_FCYC
+    set_fcyc_clear_cache(cold);
+#elif USE_FBENCH
+    set_fbench_clear_cache(cold);
+#endif
+}
+
+/*
+ * set_fsecs_samples - Set the (minimum) number of samples that
+ *     fsecs_stats and fsecs_ab take
+ */
+void set_fsecs_samples(int n)
+{
+    samples = (n < 1) ? 1 : n;
+#if USE_FBENCH
+    set_fbench_samples(n, (n > 100) ? n : 100);
+#endif
+}
+
 
+
+/*
+ * fsecs_perf - Count hardware events for one run of f. This is kept
+ *     apart from fsecs so that enabling and reading the counters never
+ *     perturbs the timing runs. perfctr_init must have been called.
+ */
+void fsecs_perf(fsecs_test_funct f, void *argp, perfctr_t *ctrs)
+{
+    perfctr_start();
+    f(argp);
+    perfctr_stop(ctrs);
+}
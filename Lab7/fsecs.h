@@ -1,4 +1,13 @@
+#include "perfctr.h"
+#include "fbench.h"
+
 typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+void fsecs_stats(fsecs_test_funct f, void *argp, fbench_t *result);
+void fsecs_ab(fsecs_test_funct fa, void *arga, fsecs_test_funct fb, 
+	      void *argb, fbench_t *ra, fbench_t *rb);
+void set_fsecs_samples(int n);
+void set_fsecs_cold(int cold);
+void fsecs_perf(fsecs_test_funct f, void *argp, perfctr_t *ctrs);
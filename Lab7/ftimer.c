@@ -7,10 +7,14 @@
  * Function timers that estimate the running time (in seconds) of a function f.
  *    ftimer_itimer: version that uses the interval timer
  *    ftimer_gettod: version that uses gettimeofday
+ *    ftimer_tsc: version that uses the invariant TSC (or a raw
+ *                monotonic clock)
  */
 #include <stdio.h>
+#include <time.h>
 #include <sys/time.h>
 #include "ftimer.h"
+#include "clock.h"
 
 /* function prototypes */
 static void init_etime(void);
@@ -53,6 +57,36 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
 }
 
 
+/* 
+ * ftimer_tsc - Use the invariant TSC to estimate the running time of
+ * f(argp), falling back on CLOCK_MONOTONIC_RAW (which, unlike
+ * gettimeofday, has nanosecond resolution and never steps) if there
+ * is no invariant TSC. Return the average of n runs.
+ */
+double ftimer_tsc(ftimer_test_funct f, void *argp, int n)
+{
+    int i;
+    double mhz = tsc_mhz(0);
+    unsigned long long start, end;
+    struct timespec sts, ets;
+
+    if (mhz > 0) {
+	start = tsc_start();
+	for (i = 0; i < n; i++) 
+	    f(argp);
+	end = tsc_stop();
+	return (end - start) / (mhz * 1e6) / n;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &sts);
+    for (i = 0; i < n; i++) 
+	f(argp);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ets);
+    return ((ets.tv_sec - sts.tv_sec) + 
+	    1E-9*(ets.tv_nsec - sts.tv_nsec)) / n;
+}
+
+
 /*
  * Routines for manipulating the Unix interval timer
  */
@@ -12,3 +12,7 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n);
    Return the average of n runs */
 double ftimer_gettod(ftimer_test_funct f, void *argp, int n);
 
+/* Estimate the running time of f(argp) using the invariant TSC, or
+   clock_gettime(CLOCK_MONOTONIC_RAW) where there isn't one.
+   Return the average of n runs */
+double ftimer_tsc(ftimer_test_funct f, void *argp, int n);
@@ -7,20 +7,41 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE  /* for sched_setaffinity() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <math.h>
 #include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <dlfcn.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "ftimer.h"
+#include "fcyc.h"
+#include "perfctr.h"
 #include "config.h"
 
+/*
+ * An mm.c need only have the lab's four routines. The rest of mm.h is
+ * optional, and a missing routine is NULL, which turns off the options
+ * that need it.
+ */
+extern void *mm_malloc_hinted(size_t size, int flags) __attribute__((weak));
+extern void mm_heapwalk(mm_visit_funct visit, void *arg) __attribute__((weak));
+extern int mm_snapshot(void) __attribute__((weak));
+extern int mm_restore(void) __attribute__((weak));
+
 /**********************
  * Constants and macros
  **********************/
@@ -49,6 +70,8 @@ typedef struct {
     enum {ALLOC, FREE, REALLOC} type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
+    int tid;                          /* thread that issues the request */
+    int hint;                         /* MM_HINT_* flags of an alloc */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -57,6 +80,7 @@ typedef struct {
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
+    int num_threads;     /* 1 + largest thread id in the trace */
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
@@ -72,16 +96,129 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* 
+ * Holds the params to eval_mt_speed, which replays a trace on several
+ * threads at once. Thread t replays ops[tops[t][0..tnops[t]-1]] in
+ * order. An op on a block that was last touched by some other op p
+ * first waits until done[p] is set, so cross-thread frees and reallocs
+ * see the block they expect.
+ */
+typedef struct {
+    trace_t *trace;
+    int nthreads;        /* number of replay threads */
+    int use_mm;          /* replay mm.c (1) or libc malloc (0)? */
+    int **tops;          /* ops replayed by each thread, in trace order */
+    int *tnops;          /* number of ops replayed by each thread */
+    int *prev;           /* prev[i] = last earlier op on the same block */
+    int *done;           /* done[i] is set once op i has completed */
+    pthread_barrier_t barrier; /* for the -B barriers */
+} mtspeed_t;
+
+/* The argument to each replay thread */
+typedef struct {
+    mtspeed_t *mt;
+    int tid;
+} mtarg_t;
+
+/* Access patterns for the payload-touching replay (--touch) */
+#define TOUCH_RECENT 1   /* the most recently allocated live blocks */
+#define TOUCH_RANDOM 2   /* live blocks chosen uniformly at random */
+#define TOUCH_ID     3   /* live blocks in order of allocation id */
+#define TOUCH_MAX_BYTES 4096 /* touch at most this much of each block */
+#define LONGBITS (8 * (int)sizeof(unsigned long))
+#define BITWORDS(n) (((n) + LONGBITS - 1) / LONGBITS)
+
+/* 
+ * Holds the params to eval_touch_speed, which replays a trace like
+ * eval_mm_speed and eval_libc_speed but also uses the payloads the
+ * way a program would: it writes every new payload, and after each
+ * request it updates ntouches live blocks chosen by pattern.
+ */
+typedef struct {
+    trace_t *trace;
+    int use_mm;          /* replay mm.c (1) or libc malloc (0)? */
+    int pattern;         /* TOUCH_RECENT, TOUCH_RANDOM or TOUCH_ID */
+    int ntouches;        /* blocks touched after each request */
+    int *live;           /* ids of the live blocks, in no order... */
+    int *pos;            /* ...pos[id] is id's index in live, or -1 */
+    int *sizes;          /* payload size of each live block */
+    int *recent;         /* ring of the ntouches newest block ids */
+    unsigned long *bits; /* bit id is set if block id is live */
+    unsigned int sum;    /* what the touches read, so they aren't dead */
+} touch_t;
+
+/* Passes over the blocks in each timed run of --hot */
+#define HOT_PASSES 64
+
+/*
+ * Holds the params to hot_speed, which reads the first word of each 
+ * of a run of same-size blocks, the way a loop over an array of 
+ * objects reads a field of each
+ */
+typedef struct {
+    char **blocks;
+    int count;
+    unsigned int sum;    /* what the reads read, so they aren't dead */
+} hot_t;
+
+/* What hint_replay measures about one replay of a trace (--hints) */
+typedef struct {
+    double util;         /* peak live payload / heap size */
+    int hot_blocks;      /* at the peak, the live hot blocks... */
+    long hot_bytes;      /* ...their payload bytes... */
+    int hot_lines;       /* ...and the cache lines... */
+    int hot_pages;       /* ...and pages that they span */
+} hintstats_t;
+
+/*
+ * An allocator that implements the mm.h interface on a simulated heap
+ * of its own. The driver makes every mm_* and heap call through the
+ * one being evaluated, which is mm.c unless --so loaded others.
+ */
+typedef struct {
+    char *name;                              /* label in the results */
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void (*heapwalk)(mm_visit_funct visit, void *arg); /* or NULL */
+    void *(*malloc_hinted)(size_t size, int flags);    /* or NULL */
+    void (*mem_init)(void);                  /* its memlib.c... */
+    void (*mem_reset_brk)(void);
+    void *(*mem_heap_lo)(void);
+    void *(*mem_heap_hi)(void);
+    size_t (*mem_heapsize)(void);
+} allocator_t;
+
+/*
+ * Holds the params to persist_replay and persist_resume, which build
+ * a file-backed heap and resume from its snapshot (--persist)
+ */
+typedef struct {
+    trace_t *trace;
+    char *path;          /* the heap file */
+    int lo, hi;          /* persist_replay replays ops lo..hi-1 */
+    int ok;              /* set if it all worked */
+} persist_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
-    double secs;     /* number of secs needed to run the trace */
+    double secs;     /* number of secs needed to run the trace (mean) */
+    double secs_sd;  /* standard deviation of the secs samples */
+    double secs_median; /* median of the secs samples */
+    double secs_ci95;   /* half-width of the 95% confidence interval */
+    int nsamples;    /* number of secs samples, after outlier rejection */
+    double secs_cold;   /* mean secs from a cold cache (--cache both) */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
+    /* defined only if hardware counters were requested with -p */
+    perfctr_t ctrs;  /* event counts for one run of the trace */
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
@@ -90,8 +227,109 @@ typedef struct {
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int perf_ctrs = 0; /* if set, count hardware events per trace (-p) */
+static int mt_barrier = 0; /* replay threads sync every mt_barrier ops (-B) */
+static int nrepeats = 1;  /* min number of times each trace is timed */
+static int cache_mode = 0; /* cache state for the timing runs (--cache) */
+static int touch_pattern = 0;  /* if set, replay with payload use (--touch) */
+static int touch_count = 4;    /* blocks touched per request (--touches) */
+static int hot_count = 0;      /* if set, allocate this many blocks... */
+static int hot_size = 0;       /* ...of this size and time them (--hot) */
+static int use_hints = 1;      /* pass the traces' hints to mm_malloc_hinted? */
+static int pages_mode = MEM_PAGES_MALLOC; /* how the heap is backed (--pages) */
+static int prefault = 0;       /* if set, fault the heap in up front */
+static double threshold = 5.0; /* smallest slowdown (%) worth reporting */
+
+/* Heap profiling during the utilization run (--timeline, --heapmap) */
+static FILE *timeline_fp = NULL; /* where the heap samples go */
+static int timeline_every = 100; /* sample the heap every this many ops */
+static FILE *heapmap_fp = NULL;  /* where the heap maps go */
+static int *heapmap_ops = NULL;  /* ops after which to dump a heap map */
+static int num_heapmap_ops = 0;
+
+/* The allocator being evaluated */
+static allocator_t mm_builtin = {"mm", mm_init, mm_malloc, mm_free, 
+				 mm_realloc, mm_heapwalk, mm_malloc_hinted,
+				 mem_init, mem_reset_brk, mem_heap_lo, 
+				 mem_heap_hi, mem_heapsize};
+static allocator_t *mm = &mm_builtin;
+
+/* mm.c isn't thread-safe, so the replay threads serialize on this lock */
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+/* 
+ * With -j, the worker processes share a table of what each of them is
+ * doing, so that a timing phase runs only while no other worker runs
+ * at all, and untimed phases wait for pending timing phases. The
+ * mutex is robust, and the parent marks the slot of every worker it
+ * reaps idle, so a worker that dies can't hang the others. (Waiters
+ * poll rather than use a condition variable, which a process that
+ * dies waiting on it can leave broken.) NULL when running serially.
+ */
+#define PHASE_IDLE    0   /* no worker, or one between phases */
+#define PHASE_RUNNING 1   /* in an untimed phase */
+#define PHASE_WAITING 2   /* waiting to start a timing phase */
+#define PHASE_TIMING  3   /* in a timing phase */
+
+typedef struct {
+    pthread_mutex_t mutex;  /* process-shared and robust */
+    int nslots;
+    int state[];            /* PHASE_* of each worker slot */
+} phase_t;
+
+static phase_t *phase = NULL;
+static int phase_slot;      /* the slot of this worker */
+
+/* The long command line options that have no short form */
+#define OPT_JSON      256
+#define OPT_CSV       257
+#define OPT_BASELINE  258
+#define OPT_REPEAT    259
+#define OPT_THRESHOLD 260
+#define OPT_TIMELINE  261
+#define OPT_EVERY     262
+#define OPT_HEAPMAP   263
+#define OPT_AB        264
+#define OPT_CPU       265
+#define OPT_CACHE     266
+#define OPT_TOUCH     267
+#define OPT_TOUCHES   268
+#define OPT_SO        269
+#define OPT_PAGES     270
+#define OPT_PREFAULT  271
+#define OPT_PERSIST   272
+#define OPT_HOT       273
+#define OPT_HINTS     274
+
+/* Cache modes for --cache */
+#define CACHE_DEFAULT 0  /* whatever the timer in fsecs.c does */
+#define CACHE_WARM    1  /* start each timed run with a warm cache */
+#define CACHE_COLD    2  /* start each timed run with a cold cache */
+#define CACHE_BOTH    3  /* time both ways */
+static struct option long_options[] = {
+    {"json",      required_argument, NULL, OPT_JSON},
+    {"csv",       required_argument, NULL, OPT_CSV},
+    {"baseline",  required_argument, NULL, OPT_BASELINE},
+    {"repeat",    required_argument, NULL, OPT_REPEAT},
+    {"threshold", required_argument, NULL, OPT_THRESHOLD},
+    {"timeline",  required_argument, NULL, OPT_TIMELINE},
+    {"every",     required_argument, NULL, OPT_EVERY},
+    {"heapmap",   required_argument, NULL, OPT_HEAPMAP},
+    {"ab",        no_argument,       NULL, OPT_AB},
+    {"cpu",       required_argument, NULL, OPT_CPU},
+    {"cache",     required_argument, NULL, OPT_CACHE},
+    {"touch",     required_argument, NULL, OPT_TOUCH},
+    {"touches",   required_argument, NULL, OPT_TOUCHES},
+    {"so",        required_argument, NULL, OPT_SO},
+    {"pages",     required_argument, NULL, OPT_PAGES},
+    {"prefault",  no_argument,       NULL, OPT_PREFAULT},
+    {"persist",   required_argument, NULL, OPT_PERSIST},
+    {"hot",       required_argument, NULL, OPT_HOT},
+    {"hints",     no_argument,       NULL, OPT_HINTS},
+    {NULL, 0, NULL, 0}
+};
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -121,12 +359,89 @@ static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
+static void *mm_alloc(traceop_t *op);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
 
+/* These functions evaluate one trace, possibly in a worker process */
+static void eval_libc_trace(char *tracefile, int tracenum, stats_t *stats);
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats,
+			  range_t **ranges);
+static void eval_parallel(int nworkers, char **tracefiles, int num_tracefiles,
+			  stats_t *libc_stats, stats_t *mm_stats, int ab);
+static void eval_ab_trace(char *tracefile, int tracenum, stats_t *libc_stats,
+			  stats_t *mm_stats, range_t **ranges);
+static void phase_enter(int pending, int mask, int state);
+static void phase_set(int slot, int state);
+static void timing_begin(void);
+static void timing_end(void);
+static void time_trace(fsecs_test_funct f, speed_t *speed_params, 
+		       stats_t *stats);
+static void record_times(stats_t *stats, fbench_t *r);
+static void flush_heap(void);
+
+/* Routines for replaying a trace on several threads at once (-T) */
+static void eval_mt_traces(int maxthreads, char **tracefiles, 
+			   int num_tracefiles);
+static void eval_mt_speed(void *ptr);
+static void *mt_replay_thread(void *ptr);
+
+/* Routines for replaying a trace that uses its payloads (--touch) */
+static void eval_touch_traces(int pattern, int ntouches, char **tracefiles,
+			      int num_tracefiles);
+static void eval_touch_speed(void *ptr);
+static void touch_block(touch_t *tp, int id);
+static int next_live_id(touch_t *tp, int id);
+
+/* Routines for timing a run of same-size blocks (--hot) */
+static void eval_hot_blocks(int count, int size, char **so_files, 
+			    int num_so);
+static void hot_speed(void *ptr);
+
+/* Compare placement with and without the traces' hints */
+static void eval_hint_traces(char **so_files, int num_so, char **tracefiles,
+			     int num_tracefiles);
+static void hint_replay(trace_t *trace, int line_size, hintstats_t *hs);
+static int cmp_long(const void *a, const void *b);
+static int count_distinct(long *v, int n);
+
+/* Routines for comparing allocators loaded as shared objects (--so) */
+static void load_allocator(char *path, allocator_t *a);
+static void eval_so_traces(int nworkers, int run_libc, char **so_files,
+			   int num_so, char **tracefiles, int num_tracefiles);
+static double perf_index(int n, stats_t *stats);
+
+/* Routine for comparing the heap on base pages and huge pages (--pages) */
+static void eval_pages(char **tracefiles, int num_tracefiles, 
+		       stats_t *mm_stats);
+
+/* Routines for restarting from a snapshot of a file-backed heap */
+static void eval_persist_traces(char *path, char **tracefiles, 
+				int num_tracefiles);
+static void persist_replay(void *ptr);
+static void persist_resume(void *ptr);
+static int check_live_blocks(trace_t *trace);
+static int read_full(int fd, void *buf, size_t n);
+
+/* Routines for machine-readable results and baseline comparison */
+static void write_results(char *path, int csv, char **tracefiles, int n,
+			  stats_t *libc_stats, stats_t *mm_stats, 
+			  double perfindex);
+static void write_stats(FILE *fp, int csv, char *tracefile, char *allocator,
+			stats_t *stats, int last);
+static int compare_baseline(char *path, char **tracefiles, int n, 
+			    stats_t *mm_stats);
+
+/* Routines for profiling fragmentation over the course of a trace */
+static void open_profile(char *path, char *heapmap_list);
+static void sample_heap(int tracenum, int opnum, int live_bytes);
+static void dump_heapmap(int tracenum, int opnum);
+static int is_heapmap_op(int opnum);
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printctrs(perfctr_t *ctrs);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -138,18 +453,29 @@ static void app_error(char *msg);
 int main(int argc, char **argv)
 {
     int i;
-    char c;
+    int c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
-    trace_t *trace = NULL;     /* stores a single trace file in memory */
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
-    speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 0;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int nworkers = 1;    /* Number of traces evaluated in parallel (-j) */
+    int maxthreads = 0;  /* If set, replay on 1..maxthreads threads (-T) */
+    int ab = 0;          /* If set, time libc and mm interleaved (--ab) */
+    char *json_file = NULL;     /* If set, write the results as JSON here */
+    char *csv_file = NULL;      /* If set, write the results as CSV here */
+    char *baseline_file = NULL; /* If set, compare the results to this run */
+    int regressions = 0;        /* number of regressions against baseline */
+    char *timeline_file = NULL; /* If set, write heap samples here */
+    char *heapmap_list = NULL;  /* If set, ops at which to dump heap maps */
+    char **so_files = NULL;     /* Allocators to compare against mm.c... */
+    int num_so = 0;             /* ...and how many of them there are */
+    char *persist_file = NULL;  /* If set, test warm restarts in this file */
+    int hints = 0;              /* If set, compare runs with and without hints */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,8 +484,116 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt_long(argc, argv, "f:t:j:T:B:hvVgalp", 
+			    long_options, NULL)) != EOF) {
         switch (c) {
+	case OPT_JSON: /* Write the results to a JSON file */
+	    json_file = optarg;
+	    break;
+	case OPT_CSV: /* Write the results to a CSV file */
+	    csv_file = optarg;
+	    break;
+	case OPT_BASELINE: /* Compare the results against a saved run */
+	    baseline_file = optarg;
+	    if (nrepeats < 2)
+		nrepeats = 5; /* need a spread to judge significance */
+	    break;
+	case OPT_REPEAT: /* Time each trace this many times */
+	    nrepeats = atoi(optarg);
+	    if (nrepeats < 1) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case OPT_THRESHOLD: /* Ignore slowdowns smaller than this percent */
+	    threshold = atof(optarg);
+	    break;
+	case OPT_TIMELINE: /* Write a heap profile time series to a file */
+	    timeline_file = optarg;
+	    break;
+	case OPT_EVERY: /* Sample the heap every n ops */
+	    timeline_every = atoi(optarg);
+	    if (timeline_every < 1) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case OPT_HEAPMAP: /* Dump heap maps after these ops */
+	    heapmap_list = optarg;
+	    break;
+	case OPT_AB: /* Time libc and mm malloc in interleaved trials */
+	    ab = 1;
+	    break;
+	case OPT_CPU: /* Pin the timing runs to this CPU */
+	    set_fbench_cpu(atoi(optarg));
+	    break;
+	case OPT_CACHE: /* Time from a warm cache, a cold one, or both */
+	    if (!strcmp(optarg, "warm"))
+		cache_mode = CACHE_WARM;
+	    else if (!strcmp(optarg, "cold"))
+		cache_mode = CACHE_COLD;
+	    else if (!strcmp(optarg, "both"))
+		cache_mode = CACHE_BOTH;
+	    else {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case OPT_TOUCH: /* Replay using the payloads, in this pattern */
+	    if (!strcmp(optarg, "recent"))
+		touch_pattern = TOUCH_RECENT;
+	    else if (!strcmp(optarg, "random"))
+		touch_pattern = TOUCH_RANDOM;
+	    else if (!strcmp(optarg, "id"))
+		touch_pattern = TOUCH_ID;
+	    else {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case OPT_TOUCHES: /* Touch this many blocks after each request */
+	    touch_count = atoi(optarg);
+	    if (touch_count < 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case OPT_SO: /* Compare mm.c with the allocator in this .so */
+	    so_files = realloc(so_files, (num_so + 1) * sizeof(char *));
+	    if (so_files == NULL)
+		unix_error("ERROR: realloc failed in main");
+	    so_files[num_so++] = optarg;
+	    break;
+	case OPT_PAGES: /* Back the simulated heap with these pages */
+	    if (!strcmp(optarg, "malloc"))
+		pages_mode = MEM_PAGES_MALLOC;
+	    else if (!strcmp(optarg, "small"))
+		pages_mode = MEM_PAGES_SMALL;
+	    else if (!strcmp(optarg, "huge"))
+		pages_mode = MEM_PAGES_HUGE;
+	    else if (!strcmp(optarg, "hugetlb"))
+		pages_mode = MEM_PAGES_HUGETLB;
+	    else {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case OPT_PREFAULT: /* Fault the whole heap in before using it */
+	    prefault = 1;
+	    break;
+	case OPT_PERSIST: /* Restart halfway through from a heap file */
+	    persist_file = optarg;
+	    break;
+	case OPT_HOT: /* Time a loop over <n> blocks of <bytes> each */
+	    if (sscanf(optarg, "%dx%d", &hot_count, &hot_size) != 2 ||
+		hot_count <= 0 || hot_size <= 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case OPT_HINTS: /* Compare placement with and without the hints */
+	    hints = 1;
+	    break;
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
 	    break;
@@ -178,12 +612,32 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+        case 'j': /* Evaluate up to this many traces in parallel */
+            nworkers = atoi(optarg);
+            if (nworkers < 1) {
+		usage();
+		exit(1);
+            }
+            break;
+        case 'T': /* Replay each trace on 1..n threads */
+            maxthreads = atoi(optarg);
+            if (maxthreads < 1) {
+		usage();
+		exit(1);
+            }
+            break;
+        case 'B': /* Replay threads meet at a barrier every n ops */
+            mt_barrier = atoi(optarg);
+            break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'p': /* Count hardware events for each trace */
+            perf_ctrs = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -198,173 +652,2422 @@ int main(int argc, char **argv)
             exit(1);
         }
     }
-	
-    /* 
-     * Check and print team info 
-     */
-    if (team_check) {
-	/* Students must fill in their team information */
-	if (!strcmp(team.teamname, "")) {
-	    printf("ERROR: Please provide the information about your team in mm.c.\n");
-	    exit(1);
-	} else
-	    printf("Team Name:%s\n", team.teamname);
-	if ((*team.name1 == '\0') || (*team.id1 == '\0')) {
-	    printf("ERROR.  You must fill in all team member 1 fields!\n");
-	    exit(1);
-	} 
-	else
-	    printf("Member 1 :%s:%s\n", team.name1, team.id1);
+	
+    /* 
+     * Check and print team info 
+     */
+    if (team_check) {
+	/* Students must fill in their team information */
+	if (!strcmp(team.teamname, "")) {
+	    printf("ERROR: Please provide the information about your team in mm.c.\n");
+	    exit(1);
+	} else
+	    printf("Team Name:%s\n", team.teamname);
+	if ((*team.name1 == '\0') || (*team.id1 == '\0')) {
+	    printf("ERROR.  You must fill in all team member 1 fields!\n");
+	    exit(1);
+	} 
+	else
+	    printf("Member 1 :%s:%s\n", team.name1, team.id1);
+
+	if (((*team.name2 != '\0') && (*team.id2 == '\0')) ||
+	    ((*team.name2 == '\0') && (*team.id2 != '\0'))) { 
+	    printf("ERROR.  You must fill in all or none of the team member 2 ID fields!\n");
+	    exit(1);
+	}
+	else if (*team.name2 != '\0')
+	    printf("Member 2 :%s:%s\n", team.name2, team.id2);
+    }
+
+    /* 
+     * If no -f command line arg, then use the entire set of tracefiles 
+     * defined in default_traces[]
+     */
+    if (tracefiles == NULL) {
+        tracefiles = default_tracefiles;
+        num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
+	printf("Using default tracefiles in %s\n", tracedir);
+    }
+
+    /* Turn off the options that need the optional parts of mm.h */
+    if (timeline_file && mm_heapwalk == NULL) {
+	printf("mm.c has no mm_heapwalk, ignoring --timeline\n");
+	timeline_file = heapmap_list = NULL;
+    }
+    if (persist_file && (mm_snapshot == NULL || mm_restore == NULL)) {
+	printf("mm.c has no mm_snapshot and mm_restore, ignoring --persist\n");
+	persist_file = NULL;
+    }
+    if (hints && mm_malloc_hinted == NULL) {
+	printf("mm.c has no mm_malloc_hinted, ignoring --hints\n");
+	hints = 0;
+    }
+
+    /* Open the heap profile files; workers would garble them, so no -j */
+    if (timeline_file) {
+	open_profile(timeline_file, heapmap_list);
+	nworkers = 1;
+    }
+    else if (heapmap_list)
+	app_error("--heapmap requires --timeline");
+
+    if (ab && !run_libc)
+	app_error("--ab requires -l");
+
+    /* Every mem_init from here on backs the heap the way we asked */
+    mem_set_pages(pages_mode, prefault);
+
+    /* Initialize the timing package */
+    init_fsecs();
+    if (nrepeats > 1)
+	set_fsecs_samples(nrepeats);
+    if (cache_mode != CACHE_DEFAULT) {
+	cacheinfo_t ci;
+
+	set_fsecs_cold(cache_mode == CACHE_COLD);
+	set_clear_cache_hook(flush_heap);
+	if (verbose) {
+	    get_cache_info(&ci);
+	    printf("Caches: L1d %ldK, L2 %ldK, LLC %ldK, %dB lines; "
+		   "clearing sweeps %ldK\n", ci.l1d >> 10, ci.l2 >> 10, 
+		   ci.llc >> 10, ci.line, cache_sweep_bytes() >> 10);
+	}
+    }
+
+    /* Open the hardware event counters, if requested and available */
+    if (perf_ctrs && perfctr_init() == 0) {
+	printf("Hardware performance counters are unavailable, ignoring -p\n");
+	perf_ctrs = 0;
+    }
+
+    /*
+     * With -T, measure how throughput scales with the number of
+     * threads replaying each trace, instead of the usual evaluation
+     */
+    if (maxthreads > 0) {
+	mem_init();
+	eval_mt_traces(maxthreads, tracefiles, num_tracefiles);
+	exit(errors ? 1 : 0);
+    }
+
+    /*
+     * With --touch, measure what each allocator's block placement 
+     * costs a program that uses its blocks, instead of the usual 
+     * evaluation
+     */
+    if (touch_pattern) {
+	mem_init();
+	eval_touch_traces(touch_pattern, touch_count, tracefiles, 
+			  num_tracefiles);
+	exit(errors ? 1 : 0);
+    }
+
+    /*
+     * With --persist, check that mm.c can stop halfway through each 
+     * trace and resume in a new process from a snapshot of its heap
+     */
+    if (persist_file) {
+	eval_persist_traces(persist_file, tracefiles, num_tracefiles);
+	exit(errors ? 1 : 0);
+    }
+
+    /*
+     * With --hot, see how a run of same-size blocks from mm.c and from
+     * each --so allocator falls in the cache sets, and what that costs
+     * a loop over them
+     */
+    if (hot_count > 0) {
+	eval_hot_blocks(hot_count, hot_size, so_files, num_so);
+	exit(errors ? 1 : 0);
+    }
+
+    /*
+     * With --hints, see what the hints in the traces buy mm.c and each 
+     * --so allocator, in utilization and in how closely the hot blocks
+     * are packed
+     */
+    if (hints) {
+	eval_hint_traces(so_files, num_so, tracefiles, num_tracefiles);
+	exit(errors ? 1 : 0);
+    }
+
+    /*
+     * With --so, evaluate mm.c and each of the shared object 
+     * allocators on every trace, and print their results side by side
+     */
+    if (num_so > 0) {
+	if (timeline_fp)
+	    app_error("--timeline can't be combined with --so");
+	eval_so_traces(nworkers, run_libc, so_files, num_so, tracefiles,
+		       num_tracefiles);
+	exit(errors ? 1 : 0);
+    }
+
+    /* Allocate the stats arrays, with one stats_t struct per tracefile */
+    if (run_libc) {
+	libc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (libc_stats == NULL)
+	    unix_error("libc_stats calloc in main failed");
+    }
+    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+    if (mm_stats == NULL)
+	unix_error("mm_stats calloc in main failed");
+
+    /*
+     * With -j, farm the traces out to worker processes, each of which
+     * evaluates both packages on its trace
+     */
+    if (nworkers > 1) {
+	/* Initialize the simulated memory system in memlib.c */
+	mem_init(); 
+	eval_parallel(nworkers, tracefiles, num_tracefiles, 
+		      libc_stats, mm_stats, ab);
+	if (run_libc && verbose) {
+	    printf("\nResults for libc malloc:\n");
+	    printresults(num_tracefiles, libc_stats);
+	}
+    }
+    else if (ab) {
+	/*
+	 * Time both packages on each trace in interleaved trials, so
+	 * that their speeds can be compared fairly
+	 */
+	mem_init();
+	for (i=0; i < num_tracefiles; i++)
+	    eval_ab_trace(tracefiles[i], i, &libc_stats[i], &mm_stats[i],
+			  &ranges);
+	if (verbose) {
+	    printf("\nResults for libc malloc:\n");
+	    printresults(num_tracefiles, libc_stats);
+	}
+    }
+    else {
+	/*
+	 * Optionally run and evaluate the libc malloc package 
+	 */
+	if (run_libc) {
+	    if (verbose > 1)
+		printf("\nTesting libc malloc\n");
+	
+	    /* Evaluate the libc malloc package using the K-best scheme */
+	    for (i=0; i < num_tracefiles; i++)
+		eval_libc_trace(tracefiles[i], i, &libc_stats[i]);
+
+	    /* Display the libc results in a compact table */
+	    if (verbose) {
+		printf("\nResults for libc malloc:\n");
+		printresults(num_tracefiles, libc_stats);
+	    }
+	}
+
+	/*
+	 * Always run and evaluate the student's mm package
+	 */
+	if (verbose > 1)
+	    printf("\nTesting mm malloc\n");
+
+	/* Initialize the simulated memory system in memlib.c */
+	mem_init(); 
+
+	/* Evaluate student's mm malloc package using the K-best scheme */
+	for (i=0; i < num_tracefiles; i++)
+	    eval_mm_trace(tracefiles[i], i, &mm_stats[i], &ranges);
+    }
+
+    /* Display the mm results in a compact table */
+    if (verbose) {
+	printf("\nResults for mm malloc:\n");
+	printresults(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* With --pages, show what the page size did to mm.c's speed */
+    if (pages_mode != MEM_PAGES_MALLOC)
+	eval_pages(tracefiles, num_tracefiles, mm_stats);
+
+    /* 
+     * Accumulate the aggregate statistics for the student's mm package 
+     */
+    secs = 0;
+    ops = 0;
+    util = 0;
+    numcorrect = 0;
+    for (i=0; i < num_tracefiles; i++) {
+	secs += mm_stats[i].secs;
+	ops += mm_stats[i].ops;
+	util += mm_stats[i].util;
+	if (mm_stats[i].valid)
+	    numcorrect++;
+    }
+    avg_mm_util = util/num_tracefiles;
+
+    /* 
+     * Compute and print the performance index 
+     */
+    if (errors == 0) {
+	avg_mm_throughput = ops/secs;
+
+	p1 = UTIL_WEIGHT * avg_mm_util;
+	if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
+	    p2 = (double)(1.0 - UTIL_WEIGHT);
+	} 
+	else {
+	    p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
+		(avg_mm_throughput/AVG_LIBC_THRUPUT);
+	}
+	
+	perfindex = (p1 + p2)*100.0;
+	printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
+	       p1*100, 
+	       p2*100, 
+	       perfindex);
+	
+    }
+    else { /* There were errors */
+	perfindex = 0.0;
+	printf("Terminated with %d errors\n", errors);
+    }
+
+    if (autograder) {
+	printf("correct:%d\n", numcorrect);
+	printf("perfidx:%.0f\n", perfindex);
+    }
+
+    /* Save the results and compare them against the baseline run */
+    if (json_file)
+	write_results(json_file, 0, tracefiles, num_tracefiles, 
+		      libc_stats, mm_stats, perfindex);
+    if (csv_file)
+	write_results(csv_file, 1, tracefiles, num_tracefiles, 
+		      libc_stats, mm_stats, perfindex);
+    if (baseline_file)
+	regressions = compare_baseline(baseline_file, tracefiles, 
+				       num_tracefiles, mm_stats);
+    if (timeline_fp)
+	fclose(timeline_fp);
+    if (heapmap_fp)
+	fclose(heapmap_fp);
+
+    exit(regressions ? 2 : 0);
+}
+
+
+/*****************************************************************
+ * The following routines evaluate a single trace and, with -j, run
+ * those evaluations in a pool of worker processes
+ ****************************************************************/
+
+/*
+ * eval_libc_trace - Check libc malloc for correctness and time it on
+ *     one tracefile
+ */
+static void eval_libc_trace(char *tracefile, int tracenum, stats_t *stats)
+{
+    trace_t *trace;
+    speed_t speed_params;
+
+    trace = read_trace(tracedir, tracefile);
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking libc malloc for correctness, ");
+    stats->valid = eval_libc_valid(trace, tracenum);
+    if (stats->valid) {
+	speed_params.trace = trace;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	time_trace(eval_libc_speed, &speed_params, stats);
+    }
+    free_trace(trace);
+}
+
+/*
+ * eval_mm_trace - Check the mm package for correctness, and measure
+ *     its utilization and speed on one tracefile
+ */
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats,
+			  range_t **ranges)
+{
+    trace_t *trace;
+    speed_t speed_params;
+
+    trace = read_trace(tracedir, tracefile);
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, ranges);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	stats->util = eval_mm_util(trace, tracenum, ranges);
+	speed_params.trace = trace;
+	speed_params.ranges = *ranges;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	time_trace(eval_mm_speed, &speed_params, stats);
+    }
+    free_trace(trace);
+}
+
+/*
+ * eval_ab_trace - Check both libc malloc and the mm package on one 
+ *     tracefile, then time them against each other in interleaved 
+ *     trials, so that anything that slows the machine down during
+ *     the measurement slows both of them down equally
+ */
+static void eval_ab_trace(char *tracefile, int tracenum, stats_t *libc_stats,
+			  stats_t *mm_stats, range_t **ranges)
+{
+    trace_t *trace;
+    speed_t libc_params, mm_params;
+    fbench_t libc_times, mm_times;
+
+    trace = read_trace(tracedir, tracefile);
+    libc_stats->ops = mm_stats->ops = trace->num_ops;
+    libc_stats->valid = eval_libc_valid(trace, tracenum);
+    mm_stats->valid = eval_mm_valid(trace, tracenum, ranges);
+    if (mm_stats->valid)
+	mm_stats->util = eval_mm_util(trace, tracenum, ranges);
+    libc_params.trace = mm_params.trace = trace;
+    mm_params.ranges = *ranges;
+
+    if (libc_stats->valid && mm_stats->valid) {
+	if (verbose > 1)
+	    printf("Timing libc and mm malloc on %s\n", tracefile);
+	timing_begin();
+	if (cache_mode == CACHE_BOTH) {
+	    set_fsecs_cold(1);
+	    fsecs_ab(eval_libc_speed, &libc_params, eval_mm_speed, 
+		     &mm_params, &libc_times, &mm_times);
+	    libc_stats->secs_cold = libc_times.mean;
+	    mm_stats->secs_cold = mm_times.mean;
+	    set_fsecs_cold(0);
+	}
+	fsecs_ab(eval_libc_speed, &libc_params, eval_mm_speed, &mm_params,
+		 &libc_times, &mm_times);
+	if (perf_ctrs) {
+	    fsecs_perf(eval_libc_speed, &libc_params, &libc_stats->ctrs);
+	    fsecs_perf(eval_mm_speed, &mm_params, &mm_stats->ctrs);
+	}
+	timing_end();
+	record_times(libc_stats, &libc_times);
+	record_times(mm_stats, &mm_times);
+    }
+    else if (libc_stats->valid) /* nothing to compare against */
+	time_trace(eval_libc_speed, &libc_params, libc_stats);
+    else if (mm_stats->valid)
+	time_trace(eval_mm_speed, &mm_params, mm_stats);
+    free_trace(trace);
+}
+
+/*
+ * time_trace - Time the speed function f (at least nrepeats times), 
+ *     and record the mean and spread of the samples and, with -p, the 
+ *     hardware event counts for one more run. With --cache both, 
+ *     also time it from a cold cache.
+ */
+static void time_trace(fsecs_test_funct f, speed_t *speed_params, 
+		       stats_t *stats)
+{
+    fbench_t times;
+
+    timing_begin();
+    if (cache_mode == CACHE_BOTH) {
+	set_fsecs_cold(1);
+	fsecs_stats(f, speed_params, &times);
+	stats->secs_cold = times.mean;
+	set_fsecs_cold(0);
+    }
+    fsecs_stats(f, speed_params, &times);
+    if (perf_ctrs)
+	fsecs_perf(f, speed_params, &stats->ctrs);
+    timing_end();
+    record_times(stats, &times);
+}
+
+/*
+ * record_times - Copy the timing statistics into a stats_t
+ */
+static void record_times(stats_t *stats, fbench_t *r)
+{
+    stats->nsamples = r->samples;
+    stats->secs = r->mean;
+    stats->secs_sd = r->sd;
+    stats->secs_median = r->median;
+    stats->secs_ci95 = r->ci95;
+}
+
+/*
+ * flush_heap - Flush the simulated heap from the cache after 
+ *     clear_caches' sweep, in case the sweep couldn't cover the whole
+ *     last level cache
+ */
+static void flush_heap(void)
+{
+    flush_cache_range(mm->mem_heap_lo(), mm->mem_heapsize());
+}
+
+/* What a worker process sends back to the parent over its pipe */
+typedef struct {
+    int errors;      /* number of errors the worker found */
+    stats_t libc;    /* libc stats for the worker's trace */
+    stats_t mm;      /* mm stats for the worker's trace */
+} result_t;
+
+/*
+ * eval_parallel - Evaluate the tracefiles in up to nworkers worker
+ *     processes at a time. Each worker is pinned to its own CPU and
+ *     evaluates one trace. The workers validate and measure 
+ *     utilization concurrently, but only one of them at a time runs
+ *     a timing phase, and only while no one else is running at all,
+ *     so the speed measurements don't interfere with each other.
+ *     libc_stats is NULL if libc malloc isn't being evaluated. With 
+ *     ab set, the two packages are timed with eval_ab_trace.
+ */
+static void eval_parallel(int nworkers, char **tracefiles, int num_tracefiles,
+			  stats_t *libc_stats, stats_t *mm_stats, int ab)
+{
+    pthread_mutexattr_t mattr;
+    cpu_set_t allowed, mine;
+    int *cpus, ncpus, cpu;
+    pid_t *pids;     /* worker running in each slot (0 if none) */
+    int *fds;        /* read end of the pipe from each worker */
+    int *tracenums;  /* trace that each worker is evaluating */
+    int fd[2];
+    int i, slot, running, next, status;
+    size_t phase_size;
+    range_t *ranges = NULL;
+    result_t result;
+    pid_t pid;
+
+    if (nworkers > num_tracefiles)
+	nworkers = num_tracefiles;
+
+    /* The phase table lives in memory shared by all of the workers */
+    phase_size = sizeof(phase_t) + nworkers * sizeof(int);
+    phase = mmap(NULL, phase_size, PROT_READ|PROT_WRITE,
+		 MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (phase == MAP_FAILED)
+	unix_error("mmap failed in eval_parallel");
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+    if (pthread_mutex_init(&phase->mutex, &mattr) != 0)
+	app_error("phase table init failed in eval_parallel");
+    pthread_mutexattr_destroy(&mattr);
+    phase->nslots = nworkers;
+    for (slot = 0; slot < nworkers; slot++)
+	phase->state[slot] = PHASE_IDLE;
+
+    /* Find the CPUs that we are allowed to pin the workers to */
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+	unix_error("sched_getaffinity failed in eval_parallel");
+    if ((cpus = (int *)malloc(CPU_SETSIZE * sizeof(int))) == NULL)
+	unix_error("malloc failed in eval_parallel");
+    ncpus = 0;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	if (CPU_ISSET(cpu, &allowed))
+	    cpus[ncpus++] = cpu;
+    if (verbose > 1)
+	printf("Evaluating %d traces with %d workers on %d cpus\n",
+	       num_tracefiles, nworkers, ncpus);
+
+    pids = (pid_t *)calloc(nworkers, sizeof(pid_t));
+    fds = (int *)calloc(nworkers, sizeof(int));
+    tracenums = (int *)calloc(nworkers, sizeof(int));
+    if (pids == NULL || fds == NULL || tracenums == NULL)
+	unix_error("calloc failed in eval_parallel");
+
+    next = 0;
+    running = 0;
+    while (next < num_tracefiles || running > 0) {
+	/* Keep every worker slot busy while there are traces left */
+	for (slot = 0; slot < nworkers && next < num_tracefiles; slot++) {
+	    if (pids[slot] != 0)
+		continue;
+	    if (pipe(fd) < 0)
+		unix_error("pipe failed in eval_parallel");
+	    fflush(stdout); /* don't let the child inherit buffered output */
+	    if ((pid = fork()) < 0)
+		unix_error("fork failed in eval_parallel");
+
+	    if (pid == 0) { /* worker */
+		close(fd[0]);
+		CPU_ZERO(&mine);
+		CPU_SET(cpus[slot % ncpus], &mine);
+		sched_setaffinity(0, sizeof(mine), &mine);
+
+		memset(&result, 0, sizeof(result));
+		phase_slot = slot;
+		phase_enter(PHASE_IDLE, 1 << PHASE_WAITING | 1 << PHASE_TIMING,
+			    PHASE_RUNNING);
+		if (ab)
+		    eval_ab_trace(tracefiles[next], next, &result.libc,
+				  &result.mm, &ranges);
+		else {
+		    if (libc_stats)
+			eval_libc_trace(tracefiles[next], next, &result.libc);
+		    eval_mm_trace(tracefiles[next], next, &result.mm, &ranges);
+		}
+		phase_set(slot, PHASE_IDLE);
+		result.errors = errors;
+		if (write(fd[1], &result, sizeof(result)) != sizeof(result))
+		    unix_error("write failed in eval_parallel");
+		exit(0);
+	    }
+
+	    close(fd[1]);
+	    pids[slot] = pid;
+	    fds[slot] = fd[0];
+	    tracenums[slot] = next++;
+	    running++;
+	}
+
+	/* Collect the results of the next worker to finish */
+	if ((pid = wait(&status)) < 0)
+	    unix_error("wait failed in eval_parallel");
+	for (slot = 0; slot < nworkers && pids[slot] != pid; slot++)
+	    ;
+	if (slot == nworkers)
+	    continue;
+	phase_set(slot, PHASE_IDLE); /* in case it died in a phase */
+	i = tracenums[slot];
+	if (read(fds[slot], &result, sizeof(result)) != sizeof(result)) {
+	    malloc_error(i, 0, "worker process died");
+	    mm_stats[i].ops = 0;
+	    mm_stats[i].valid = 0;
+	}
+	else {
+	    errors += result.errors;
+	    if (libc_stats)
+		libc_stats[i] = result.libc;
+	    mm_stats[i] = result.mm;
+	}
+	close(fds[slot]);
+	pids[slot] = 0;
+	running--;
+    }
+
+    pthread_mutex_destroy(&phase->mutex);
+    munmap(phase, phase_size);
+    phase = NULL;
+    free(cpus);
+    free(pids);
+    free(fds);
+    free(tracenums);
+}
+
+/*
+ * phase_lock - Lock the phase table, taking it over if a worker died
+ *     while holding it
+ */
+static void phase_lock(void)
+{
+    if (pthread_mutex_lock(&phase->mutex) == EOWNERDEAD)
+	pthread_mutex_consistent(&phase->mutex);
+}
+
+/*
+ * phase_enter - Put this worker's slot in the pending state, wait
+ *     until no other slot is in any of the states in mask (a bit per
+ *     PHASE_* state), then put it in state.
+ */
+static void phase_enter(int pending, int mask, int state)
+{
+    struct timespec pause = {0, 1000000}; /* 1 ms between polls */
+    int i, busy;
+
+    phase_lock();
+    phase->state[phase_slot] = pending;
+    for (;;) {
+	busy = 0;
+	for (i = 0; i < phase->nslots; i++)
+	    if (i != phase_slot && (mask & 1 << phase->state[i]))
+		busy = 1;
+	if (!busy)
+	    break;
+	pthread_mutex_unlock(&phase->mutex);
+	nanosleep(&pause, NULL);
+	phase_lock();
+    }
+    phase->state[phase_slot] = state;
+    pthread_mutex_unlock(&phase->mutex);
+}
+
+/*
+ * phase_set - Put a slot in a state without waiting
+ */
+static void phase_set(int slot, int state)
+{
+    phase_lock();
+    phase->state[slot] = state;
+    pthread_mutex_unlock(&phase->mutex);
+}
+
+/*
+ * timing_begin - Called before a timing phase. With -j, wait until 
+ *     we are the only worker running.
+ */
+static void timing_begin(void)
+{
+    if (phase)
+	phase_enter(PHASE_WAITING, 1 << PHASE_RUNNING | 1 << PHASE_TIMING,
+		    PHASE_TIMING);
+}
+
+/*
+ * timing_end - Called after a timing phase. With -j, let the other
+ *     workers run again, once those waiting to time have had a turn.
+ */
+static void timing_end(void)
+{
+    if (phase)
+	phase_enter(PHASE_IDLE, 1 << PHASE_WAITING | 1 << PHASE_TIMING,
+		    PHASE_RUNNING);
+}
+
+/*****************************************************************
+ * The following routines replay a trace on several threads at once
+ * to measure how an allocator copes with contention (-T)
+ ****************************************************************/
+
+/*
+ * eval_mt_traces - For each trace and for each thread count from 1 to
+ *     maxthreads, time a concurrent replay of the trace with mm.c and 
+ *     with libc malloc, and print a table of throughputs followed by
+ *     the aggregate scalability curve.
+ *
+ *     Requests tagged with a thread id (t=<tid>) are replayed by
+ *     thread tid mod n. Traces without any thread ids are split 
+ *     across the n threads by block id, so each block stays on one 
+ *     thread. Since mm.c isn't thread-safe, its replay threads take a
+ *     global lock around every call.
+ */
+static void eval_mt_traces(int maxthreads, char **tracefiles, 
+			   int num_tracefiles)
+{
+    trace_t *trace;
+    range_t *ranges = NULL;
+    mtspeed_t mt;
+    int i, j, n, t, owner, valid;
+    int *last;         /* last op on each block id */
+    double secs, *mm_secs, *libc_secs, total_ops;
+
+    mm_secs = (double *)calloc(maxthreads + 1, sizeof(double));
+    libc_secs = (double *)calloc(maxthreads + 1, sizeof(double));
+    mt.tops = (int **)calloc(maxthreads, sizeof(int *));
+    mt.tnops = (int *)calloc(maxthreads, sizeof(int));
+    if (!mm_secs || !libc_secs || !mt.tops || !mt.tnops)
+	unix_error("calloc failed in eval_mt_traces");
+
+    /* The replay threads would inherit fbench's pinning to one CPU */
+    set_fbench_pin(0);
+
+    printf("\nMulti-threaded replay (%s):\n", 
+	   mt_barrier ? "with barriers" : "no barriers");
+    printf("%5s%8s%8s%10s%10s\n", 
+	   "trace", "ops", "threads", "mm Kops", "libc Kops");
+    total_ops = 0;
+    for (i = 0; i < num_tracefiles; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+
+	/* Don't let a broken mm.c loose on several threads */
+	valid = eval_mm_valid(trace, i, &ranges);
+	clear_ranges(&ranges);
+	if (!valid) {
+	    printf("%2d%11s%8s%10s%10s\n", i, "-", "-", "no", "-");
+	    free_trace(trace);
+	    continue;
+	}
+	total_ops += trace->num_ops;
+
+	/* Find the op that each op has to wait for, if any */
+	mt.trace = trace;
+	mt.prev = (int *)malloc(trace->num_ops * sizeof(int));
+	mt.done = (int *)malloc(trace->num_ops * sizeof(int));
+	last = (int *)malloc(trace->num_ids * sizeof(int));
+	if (!mt.prev || !mt.done || !last)
+	    unix_error("malloc failed in eval_mt_traces");
+	for (j = 0; j < trace->num_ids; j++)
+	    last[j] = -1;
+	for (j = 0; j < trace->num_ops; j++) {
+	    mt.prev[j] = (trace->ops[j].type == ALLOC) ? 
+		-1 : last[trace->ops[j].index];
+	    last[trace->ops[j].index] = j;
+	}
+	free(last);
+
+	for (n = 1; n <= maxthreads; n++) {
+	    /* Deal the ops out to the n threads */
+	    mt.nthreads = n;
+	    for (t = 0; t < n; t++) {
+		mt.tops[t] = (int *)malloc(trace->num_ops * sizeof(int));
+		if (mt.tops[t] == NULL)
+		    unix_error("malloc failed in eval_mt_traces");
+		mt.tnops[t] = 0;
+	    }
+	    for (j = 0; j < trace->num_ops; j++) {
+		owner = (trace->num_threads > 1) ? 
+		    trace->ops[j].tid % n : trace->ops[j].index % n;
+		mt.tops[owner][mt.tnops[owner]++] = j;
+	    }
+
+	    mt.use_mm = 1;
+	    secs = fsecs(eval_mt_speed, &mt);
+	    mm_secs[n] += secs;
+	    printf("%2d%11d%8d%10.0f", i, trace->num_ops, n, 
+		   (trace->num_ops/1e3)/secs);
+	    mt.use_mm = 0;
+	    secs = fsecs(eval_mt_speed, &mt);
+	    libc_secs[n] += secs;
+	    printf("%10.0f\n", (trace->num_ops/1e3)/secs);
+
+	    for (t = 0; t < n; t++)
+		free(mt.tops[t]);
+	}
+	free(mt.prev);
+	free(mt.done);
+	free_trace(trace);
+    }
+
+    /* Print the aggregate scalability curve */
+    if (total_ops > 0) {
+	printf("\nScalability over all traces:\n");
+	printf("%7s%10s%9s%10s%9s\n", 
+	       "threads", "mm Kops", "speedup", "libc Kops", "speedup");
+	for (n = 1; n <= maxthreads; n++)
+	    printf("%7d%10.0f%8.2fx%10.0f%8.2fx\n", n,
+		   (total_ops/1e3)/mm_secs[n], mm_secs[1]/mm_secs[n],
+		   (total_ops/1e3)/libc_secs[n], libc_secs[1]/libc_secs[n]);
+    }
+
+    free(mm_secs);
+    free(libc_secs);
+    free(mt.tops);
+    free(mt.tnops);
+    set_fbench_pin(1);
+}
+
+/*
+ * eval_mt_speed - This is the function that is used by fsecs() to 
+ *    measure the running time of a concurrent replay of a trace
+ */
+static void eval_mt_speed(void *ptr)
+{
+    mtspeed_t *mt = (mtspeed_t *)ptr;
+    pthread_t *threads;
+    mtarg_t *args;
+    int t;
+
+    if (mt->use_mm) {
+	mm->mem_reset_brk();
+	if (mm->init() < 0) 
+	    app_error("mm_init failed in eval_mt_speed");
+    }
+    memset(mt->done, 0, mt->trace->num_ops * sizeof(int));
+    if (mt_barrier > 0)
+	pthread_barrier_init(&mt->barrier, NULL, mt->nthreads);
+
+    threads = (pthread_t *)malloc(mt->nthreads * sizeof(pthread_t));
+    args = (mtarg_t *)malloc(mt->nthreads * sizeof(mtarg_t));
+    if (threads == NULL || args == NULL)
+	unix_error("malloc failed in eval_mt_speed");
+    for (t = 0; t < mt->nthreads; t++) {
+	args[t].mt = mt;
+	args[t].tid = t;
+	if (pthread_create(&threads[t], NULL, mt_replay_thread, &args[t]))
+	    app_error("pthread_create failed in eval_mt_speed");
+    }
+    for (t = 0; t < mt->nthreads; t++)
+	pthread_join(threads[t], NULL);
+
+    if (mt_barrier > 0)
+	pthread_barrier_destroy(&mt->barrier);
+    free(threads);
+    free(args);
+}
+
+/*
+ * mt_replay_thread - Replay one thread's share of a trace. With -B, 
+ *    every thread waits at a barrier after each mt_barrier trace ops.
+ */
+static void *mt_replay_thread(void *ptr)
+{
+    mtspeed_t *mt = ((mtarg_t *)ptr)->mt;
+    trace_t *trace = mt->trace;
+    int *ops = mt->tops[((mtarg_t *)ptr)->tid];
+    int nops = mt->tnops[((mtarg_t *)ptr)->tid];
+    int epoch = (mt_barrier > 0) ? mt_barrier : trace->num_ops;
+    int end, i, j, p, index, size;
+    char *newp;
+
+    for (end = epoch, j = 0; ; end += epoch) {
+	for (; j < nops && ops[j] < end; j++) {
+	    i = ops[j];
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    /* Wait for the op that last touched this block */
+	    if ((p = mt->prev[i]) >= 0)
+		while (!__atomic_load_n(&mt->done[p], __ATOMIC_ACQUIRE))
+		    sched_yield();
+
+	    switch (trace->ops[i].type) {
+	    case ALLOC:
+		if (mt->use_mm) {
+		    pthread_mutex_lock(&mm_lock);
+		    newp = mm->malloc(size);
+		    pthread_mutex_unlock(&mm_lock);
+		}
+		else
+		    newp = malloc(size);
+		if (newp == NULL)
+		    app_error("malloc failed in mt_replay_thread");
+		trace->blocks[index] = newp;
+		break;
+
+	    case REALLOC:
+		if (mt->use_mm) {
+		    pthread_mutex_lock(&mm_lock);
+		    newp = mm->realloc(trace->blocks[index], size);
+		    pthread_mutex_unlock(&mm_lock);
+		}
+		else
+		    newp = realloc(trace->blocks[index], size);
+		if (newp == NULL)
+		    app_error("realloc failed in mt_replay_thread");
+		trace->blocks[index] = newp;
+		break;
+
+	    case FREE:
+		if (mt->use_mm) {
+		    pthread_mutex_lock(&mm_lock);
+		    mm->free(trace->blocks[index]);
+		    pthread_mutex_unlock(&mm_lock);
+		}
+		else
+		    free(trace->blocks[index]);
+		break;
+	    }
+	    __atomic_store_n(&mt->done[i], 1, __ATOMIC_RELEASE);
+	}
+	if (end >= trace->num_ops)
+	    break;
+	if (mt_barrier > 0)
+	    pthread_barrier_wait(&mt->barrier);
+    }
+    return NULL;
+}
+
+/*****************************************************************
+ * The following routines replay a trace the way a program would use
+ * the blocks, to measure how an allocator's placement decisions
+ * affect the cache misses of the program around it (--touch)
+ ****************************************************************/
+
+/*
+ * eval_touch_traces - For each trace, time a payload-touching replay
+ *     with mm.c and with libc malloc, and print their throughputs and
+ *     (if the hardware counters are available) their L1 data and last
+ *     level cache misses. A placement policy that packs blocks that
+ *     are used together into fewer lines and pages comes out ahead
+ *     here even if its mm_malloc is slower.
+ */
+static void eval_touch_traces(int pattern, int ntouches, char **tracefiles,
+			      int num_tracefiles)
+{
+    static char *names[] = {"", "recent", "random", "id"};
+    trace_t *trace;
+    range_t *ranges = NULL;
+    touch_t touch;
+    perfctr_t ctrs;
+    double secs;
+    int i, j, valid, have_ctrs;
+
+    have_ctrs = perf_ctrs || perfctr_init() > 0;
+    printf("\nPayload-touching replay (%s, %d blocks per request):\n", 
+	   names[pattern], ntouches);
+    printf("%5s%8s%10s%8s%10s%10s%10s%8s%10s%10s\n", "trace", "ops",
+	   "mm secs", "Kops", "KL1Dmiss", "KLLCmiss", 
+	   "libc secs", "Kops", "KL1Dmiss", "KLLCmiss");
+
+    for (i = 0; i < num_tracefiles; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+
+	/* Only replay a trace that mm.c gets right */
+	valid = eval_mm_valid(trace, i, &ranges);
+	clear_ranges(&ranges);
+	if (!valid) {
+	    printf("%2d%11s%10s\n", i, "-", "invalid");
+	    free_trace(trace);
+	    continue;
+	}
+
+	touch.trace = trace;
+	touch.pattern = pattern;
+	touch.ntouches = ntouches;
+	touch.live = (int *)malloc(trace->num_ids * sizeof(int));
+	touch.pos = (int *)malloc(trace->num_ids * sizeof(int));
+	touch.sizes = (int *)malloc(trace->num_ids * sizeof(int));
+	touch.recent = (int *)malloc((ntouches + 1) * sizeof(int));
+	touch.bits = (unsigned long *)malloc(BITWORDS(trace->num_ids) * 
+					     sizeof(unsigned long));
+	if (!touch.live || !touch.pos || !touch.sizes || !touch.recent ||
+	    !touch.bits)
+	    unix_error("malloc failed in eval_touch_traces");
+
+	printf("%2d%11d", i, trace->num_ops);
+	for (j = 1; j >= 0; j--) {
+	    touch.use_mm = j;
+	    secs = fsecs(eval_touch_speed, &touch);
+	    printf("%10.6f%8.0f", secs, (trace->num_ops/1e3)/secs);
+	    if (have_ctrs) {
+		fsecs_perf(eval_touch_speed, &touch, &ctrs);
+		if (ctrs.valid[PC_L1D_MISS])
+		    printf("%10.0f", ctrs.count[PC_L1D_MISS]/1e3);
+		else
+		    printf("%10s", "-");
+		if (ctrs.valid[PC_LLC_MISS])
+		    printf("%10.0f", ctrs.count[PC_LLC_MISS]/1e3);
+		else
+		    printf("%10s", "-");
+	    }
+	    else
+		printf("%10s%10s", "-", "-");
+	}
+	printf("\n");
+
+	free(touch.live);
+	free(touch.pos);
+	free(touch.sizes);
+	free(touch.recent);
+	free(touch.bits);
+	free_trace(trace);
+    }
+}
+
+/*
+ * eval_touch_speed - Replay a trace with mm.c or libc malloc, writing
+ *     each new payload, then touching ntouches live blocks after each
+ *     request. The random choices are the same on every run.
+ */
+static void eval_touch_speed(void *ptr)
+{
+    touch_t *tp = (touch_t *)ptr;
+    trace_t *trace = tp->trace;
+    unsigned int seed = 1;
+    int i, k, id, size, oldsize, nlive = 0, nrecent = 0, cursor = 0;
+    char *p;
+
+    if (tp->use_mm) {
+	mm->mem_reset_brk();
+	if (mm->init() < 0)
+	    app_error("mm_init failed in eval_touch_speed");
+    }
+    for (id = 0; id < trace->num_ids; id++)
+	tp->pos[id] = -1;
+    memset(tp->bits, 0, BITWORDS(trace->num_ids) * sizeof(unsigned long));
+
+    for (i = 0; i < trace->num_ops; i++) {
+	id = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    p = tp->use_mm ? mm->malloc(size) : malloc(size);
+	    if (p == NULL)
+		app_error("malloc failed in eval_touch_speed");
+	    memset(p, id, size);
+	    trace->blocks[id] = p;
+	    tp->sizes[id] = size;
+	    tp->pos[id] = nlive;
+	    tp->live[nlive++] = id;
+	    tp->recent[nrecent++ % (tp->ntouches + 1)] = id;
+	    tp->bits[id / LONGBITS] |= 1UL << (id % LONGBITS);
+	    break;
+
+	case REALLOC: /* the program fills in the part that is new */
+	    p = tp->use_mm ? mm->realloc(trace->blocks[id], size) :
+		realloc(trace->blocks[id], size);
+	    if (p == NULL)
+		app_error("realloc failed in eval_touch_speed");
+	    oldsize = tp->sizes[id];
+	    if (size > oldsize)
+		memset(p + oldsize, id, size - oldsize);
+	    trace->blocks[id] = p;
+	    tp->sizes[id] = size;
+	    break;
+
+	case FREE: /* move the last live block into the hole */
+	    if (tp->use_mm)
+		mm->free(trace->blocks[id]);
+	    else
+		free(trace->blocks[id]);
+	    k = tp->pos[id];
+	    tp->live[k] = tp->live[--nlive];
+	    tp->pos[tp->live[k]] = k;
+	    tp->pos[id] = -1;
+	    tp->bits[id / LONGBITS] &= ~(1UL << (id % LONGBITS));
+	    break;
+	}
+
+	if (nlive == 0)
+	    continue;
+	for (k = 0; k < tp->ntouches; k++) {
+	    switch (tp->pattern) {
+	    case TOUCH_RECENT: /* newest first, skipping freed ones */
+		if (k >= nrecent)
+		    break;
+		id = tp->recent[(nrecent - 1 - k) % (tp->ntouches + 1)];
+		if (tp->pos[id] >= 0)
+		    touch_block(tp, id);
+		break;
+	    case TOUCH_RANDOM:
+		seed = seed * 1103515245 + 12345;
+		touch_block(tp, tp->live[(seed >> 8) % nlive]);
+		break;
+	    case TOUCH_ID: /* walk the live ids round robin */
+		cursor = next_live_id(tp, cursor + 1);
+		touch_block(tp, cursor);
+		break;
+	    }
+	}
+    }
+}
+
+/*
+ * next_live_id - Return the smallest live block id >= id, wrapping
+ *     around to 0 if there isn't one. There must be a live block.
+ */
+static int next_live_id(touch_t *tp, int id)
+{
+    int nwords = BITWORDS(tp->trace->num_ids);
+    int w = id / LONGBITS;
+    unsigned long word;
+
+    if (id >= tp->trace->num_ids)
+	w = id = 0;
+    word = tp->bits[w] & (~0UL << (id % LONGBITS));
+    while (word == 0) {
+	w = (w + 1) % nwords;
+	word = tp->bits[w];
+    }
+    return w * LONGBITS + __builtin_ctzl(word);
+}
+
+/*
+ * touch_block - Read and update one word in each cache line of the 
+ *     first TOUCH_MAX_BYTES bytes of a live block's payload
+ */
+static void touch_block(touch_t *tp, int id)
+{
+    unsigned char *p = (unsigned char *)tp->trace->blocks[id];
+    int size = tp->sizes[id];
+    int j;
+
+    if (size > TOUCH_MAX_BYTES)
+	size = TOUCH_MAX_BYTES;
+    for (j = 0; j < size; j += 64) {
+	tp->sum += p[j];
+	p[j]++;
+    }
+}
+
+/*****************************************************************
+ * The following routines see how a run of same-size blocks falls in
+ * the cache sets (--hot)
+ ****************************************************************/
+
+/*
+ * eval_hot_blocks - For mm.c and each of the num_so allocators in
+ *     so_files, allocate count blocks of size bytes in a row, and count
+ *     the L1 data cache sets that their first lines fall in. With LRU
+ *     replacement, a loop over the blocks misses on every line in a set
+ *     that holds more of them than it has ways, however few lines there
+ *     are in all. Then time such a loop.
+ */
+static void eval_hot_blocks(int count, int size, char **so_files, 
+			    int num_so)
+{
+    allocator_t *allocs;
+    cacheinfo_t ci;
+    hot_t hot;
+    fbench_t result;
+    int *lines;
+    int a, i, set, nsets, ways, line, used, most, misses;
+    int nallocs = num_so + 1;
+
+    /* The L1d geometry, or a typical one if sysfs doesn't say */
+    get_cache_info(&ci);
+    line = ci.line ? ci.line : 64;
+    ways = ci.l1d_ways ? ci.l1d_ways : 8;
+    nsets = ci.l1d ? ci.l1d / (line * ways) : 64;
+
+    allocs = (allocator_t *)calloc(nallocs, sizeof(allocator_t));
+    hot.blocks = (char **)calloc(count, sizeof(char *));
+    lines = (int *)calloc(nsets, sizeof(int));
+    if (allocs == NULL || hot.blocks == NULL || lines == NULL)
+	unix_error("calloc failed in eval_hot_blocks");
+    allocs[0] = mm_builtin;
+    for (a = 1; a < nallocs; a++)
+	load_allocator(so_files[a-1], &allocs[a]);
+    hot.count = count;
+    hot.sum = 0;
+
+    printf("\n%d blocks of %d bytes; L1d has %d sets of %d %dB lines:\n",
+	   count, size, nsets, ways, line);
+    printf("%-16s %8s %10s %12s %10s\n", "allocator", "sets", "most/set",
+	   "misses/pass", "ns/block");
+    for (a = 0; a < nallocs; a++) {
+	mm = &allocs[a];
+	mm->mem_init();
+	if (mm->init() < 0)
+	    app_error("mm_init failed in eval_hot_blocks");
+	for (i = 0; i < count; i++) {
+	    if ((hot.blocks[i] = mm->malloc(size)) == NULL) {
+		sprintf(msg, "%s ran out of memory in eval_hot_blocks", 
+			allocs[a].name);
+		app_error(msg);
+	    }
+	    memset(hot.blocks[i], 0, size);
+	}
+
+	memset(lines, 0, nsets * sizeof(int));
+	for (i = 0; i < count; i++)
+	    lines[((unsigned long)hot.blocks[i] / line) % nsets]++;
+	used = most = misses = 0;
+	for (set = 0; set < nsets; set++) {
+	    if (lines[set] > 0)
+		used++;
+	    if (lines[set] > most)
+		most = lines[set];
+	    if (lines[set] > ways)
+		misses += lines[set];
+	}
+
+	fbench(hot_speed, &hot, &result);
+	printf("%-16.16s %8d %10d %12d %10.2f\n", allocs[a].name, used, most,
+	       misses, result.median * 1e9 / ((double)count * HOT_PASSES));
+    }
+    mm = &mm_builtin;
+
+    free(lines);
+    free(hot.blocks);
+    free(allocs);
+}
+
+/*
+ * hot_speed - Read the first word of every block, HOT_PASSES times
+ */
+static void hot_speed(void *ptr)
+{
+    hot_t *hp = (hot_t *)ptr;
+    int i, pass;
+
+    for (pass = 0; pass < HOT_PASSES; pass++)
+	for (i = 0; i < hp->count; i++)
+	    hp->sum += *(unsigned int *)hp->blocks[i];
+}
+
+/*****************************************************************
+ * The following routines replay traces with and without their 
+ * allocation hints, to see what the hints buy (--hints)
+ ****************************************************************/
+
+/*
+ * eval_hint_traces - Replay each trace on mm.c and on each of the 
+ *     num_so allocators in so_files, first ignoring the h= hints in 
+ *     the trace and then passing them to mm_malloc_hinted, and print
+ *     the utilization of both runs and how many cache lines and pages
+ *     the live hot blocks spanned at the trace's peak
+ */
+static void eval_hint_traces(char **so_files, int num_so, char **tracefiles,
+			     int num_tracefiles)
+{
+    allocator_t *allocs;
+    trace_t *trace;
+    range_t *ranges = NULL;
+    hintstats_t hs;
+    cacheinfo_t ci;
+    int a, i, t, hinted, allocs_in_trace, line;
+    int nallocs = num_so + 1;
+
+    get_cache_info(&ci);
+    line = ci.line ? ci.line : 64;
+
+    allocs = (allocator_t *)calloc(nallocs, sizeof(allocator_t));
+    if (allocs == NULL)
+	unix_error("calloc failed in eval_hint_traces");
+    allocs[0] = mm_builtin;
+    for (a = 1; a < nallocs; a++) {
+	load_allocator(so_files[a-1], &allocs[a]);
+	allocs[a].mem_init();
+    }
+    mem_init();
+
+    for (t = 0; t < num_tracefiles; t++) {
+	trace = read_trace(tracedir, tracefiles[t]);
+	hinted = allocs_in_trace = 0;
+	for (i = 0; i < trace->num_ops; i++)
+	    if (trace->ops[i].type == ALLOC) {
+		allocs_in_trace++;
+		if (trace->ops[i].hint)
+		    hinted++;
+	    }
+	printf("\n%s: %d of %d allocs have hints; %dB lines\n", tracefiles[t],
+	       hinted, allocs_in_trace, line);
+	printf("%-16s %5s %6s %10s %8s %8s %8s %8s\n", "allocator", "hints",
+	       "util", "hot blocks", "hot KB", "lines", "pages", "density");
+	for (a = 0; a < nallocs; a++) {
+	    mm = &allocs[a];
+	    for (use_hints = 0; use_hints <= 1; use_hints++) {
+		if (!eval_mm_valid(trace, t, &ranges)) {
+		    printf("%-16.16s %5s invalid\n", allocs[a].name, 
+			   use_hints ? "used" : "off");
+		    continue;
+		}
+		hint_replay(trace, line, &hs);
+		printf("%-16.16s %5s %5.1f%% %10d %8.1f %8d %8d %7.1f%%\n",
+		       allocs[a].name, (use_hints && mm->malloc_hinted) ? 
+		       "used" : "off", hs.util * 100.0, hs.hot_blocks,
+		       hs.hot_bytes / 1024.0, hs.hot_lines, hs.hot_pages,
+		       hs.hot_lines ? 100.0 * hs.hot_bytes / 
+		       ((double)hs.hot_lines * line) : 0.0);
+	    }
+	}
+	clear_ranges(&ranges);
+	free_trace(trace);
+    }
+    mm = &mm_builtin;
+    use_hints = 1;
+    free(allocs);
+}
+
+/*
+ * hint_replay - Replay a trace like eval_mm_util and measure its
+ *     utilization. After the request at which the most payload is 
+ *     live, also find the cache lines and pages that hold the payloads
+ *     of the live hot blocks (MM_HINT_HOT): the fewer they are for the
+ *     same bytes, the more of the hot data each miss brings in.
+ */
+static void hint_replay(trace_t *trace, int line_size, hintstats_t *hs)
+{
+    int i, index, size, peak_op = -1;
+    long total = 0, peak = 0, *lines, line, nlines = 0, maxlines = 1024;
+    int *hints;
+    char *p;
+
+    memset(hs, 0, sizeof(*hs));
+    hints = (int *)calloc(trace->num_ids, sizeof(int));
+    lines = (long *)malloc(maxlines * sizeof(long));
+    if (hints == NULL || lines == NULL)
+	unix_error("malloc failed in hint_replay");
+
+    /* Find the peak, and the hints that each block was allocated with */
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    hints[index] = trace->ops[i].hint;
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    total += trace->ops[i].size;
+	    break;
+	case REALLOC:
+	    total += trace->ops[i].size - (long)trace->block_sizes[index];
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case FREE:
+	    total -= trace->block_sizes[index];
+	    trace->block_sizes[index] = 0;
+	    break;
+	}
+	if (total > peak) {
+	    peak = total;
+	    peak_op = i;
+	}
+    }
+
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    mm->mem_reset_brk();
+    if (mm->init() < 0)
+	app_error("mm_init failed in hint_replay");
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm_alloc(&trace->ops[i])) == NULL)
+		app_error("mm_malloc failed in hint_replay");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+	case REALLOC:
+	    if ((p = mm->realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc failed in hint_replay");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+	case FREE:
+	    mm->free(trace->blocks[index]);
+	    trace->blocks[index] = NULL;
+	    break;
+	}
+	if (i != peak_op)
+	    continue;
+
+	/* List the lines that each live hot payload touches */
+	for (index = 0; index < trace->num_ids; index++) {
+	    p = trace->blocks[index];
+	    if (!(hints[index] & MM_HINT_HOT) || p == NULL || 
+		trace->block_sizes[index] == 0)
+		continue;
+	    hs->hot_blocks++;
+	    hs->hot_bytes += trace->block_sizes[index];
+	    for (line = (long)p / line_size; 
+		 line <= (long)(p + trace->block_sizes[index] - 1) / line_size;
+		 line++) {
+		if (nlines == maxlines) {
+		    maxlines *= 2;
+		    if ((lines = realloc(lines, maxlines * sizeof(long))) == NULL)
+			unix_error("realloc failed in hint_replay");
+		}
+		lines[nlines++] = line;
+	    }
+	}
+	hs->hot_lines = count_distinct(lines, nlines);
+	for (line = 0; line < hs->hot_lines; line++)
+	    lines[line] = lines[line] * line_size / (long)mem_pagesize();
+	hs->hot_pages = count_distinct(lines, hs->hot_lines);
+    }
+    hs->util = (double)peak / (double)mm->mem_heapsize();
+
+    free(lines);
+    free(hints);
+}
+
+/* cmp_long - qsort comparison function for longs */
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * count_distinct - Sort v[0..n-1], squeeze out repeats, and return
+ *     how many values are left at the front of v
+ */
+static int count_distinct(long *v, int n)
+{
+    int i, m = 0;
+
+    qsort(v, n, sizeof(long), cmp_long);
+    for (i = 0; i < n; i++)
+	if (m == 0 || v[i] != v[m-1])
+	    v[m++] = v[i];
+    return m;
+}
+
+/*****************************************************************
+ * The following routines load other allocators from shared objects
+ * and compare them with mm.c on the same traces (--so)
+ ****************************************************************/
+
+/*
+ * load_allocator - Load an allocator from the shared object at path.
+ *     It must export the mm.h interface (mm_heapwalk and
+ *     mm_malloc_hinted are optional) and the memlib.h routines of the
+ *     memlib.c it was linked with, which gives it a simulated heap of
+ *     its own. "make foo.so" builds one from foo.c.
+ */
+static void load_allocator(char *path, allocator_t *a)
+{
+    void *handle;
+    void (*set_pages)(int mode, int prefault);
+    char *name, *dot;
+
+    if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+	snprintf(msg, sizeof(msg), "Could not load %.900s: %s", path, dlerror());
+	app_error(msg);
+    }
+
+#define LOAD(field, sym) \
+    if ((*(void **)&a->field = dlsym(handle, sym)) == NULL) { \
+	sprintf(msg, "%.900s does not export %s", path, sym); \
+	app_error(msg); \
+    }
+    LOAD(init, "mm_init");
+    LOAD(malloc, "mm_malloc");
+    LOAD(free, "mm_free");
+    LOAD(realloc, "mm_realloc");
+    LOAD(mem_init, "mem_init");
+    LOAD(mem_reset_brk, "mem_reset_brk");
+    LOAD(mem_heap_lo, "mem_heap_lo");
+    LOAD(mem_heap_hi, "mem_heap_hi");
+    LOAD(mem_heapsize, "mem_heapsize");
+#undef LOAD
+    *(void **)&a->heapwalk = dlsym(handle, "mm_heapwalk");
+    *(void **)&a->malloc_hinted = dlsym(handle, "mm_malloc_hinted");
+
+    /* Back its heap the same way as mm.c's, if its memlib.c can */
+    if ((*(void **)&set_pages = dlsym(handle, "mem_set_pages")) != NULL)
+	set_pages(pages_mode, prefault);
+
+    /* Label it with its file name, less the directory and ".so" */
+    name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    if ((a->name = strdup(name)) == NULL)
+	unix_error("strdup failed in load_allocator");
+    if ((dot = strstr(a->name, ".so")) != NULL && dot != a->name)
+	*dot = '\0';
+}
+
+/*
+ * eval_so_traces - Evaluate mm.c and each of the num_so allocators in
+ *     so_files (and libc malloc, if run_libc is set) on every trace,
+ *     one allocator at a time, and print their utilization and 
+ *     throughput side by side, with the performance index that each
+ *     of them would get
+ */
+static void eval_so_traces(int nworkers, int run_libc, char **so_files,
+			   int num_so, char **tracefiles, int num_tracefiles)
+{
+    allocator_t *allocs;
+    stats_t **stats, *libc_stats = NULL;
+    range_t *ranges = NULL;
+    double util, ops, secs;
+    int a, i, nallocs = num_so + 1;
+
+    allocs = (allocator_t *)calloc(nallocs, sizeof(allocator_t));
+    stats = (stats_t **)calloc(nallocs, sizeof(stats_t *));
+    if (allocs == NULL || stats == NULL)
+	unix_error("calloc failed in eval_so_traces");
+    allocs[0] = mm_builtin;
+    for (a = 1; a < nallocs; a++)
+	load_allocator(so_files[a-1], &allocs[a]);
+
+    if (run_libc) {
+	if ((libc_stats = (stats_t *)calloc(num_tracefiles, 
+					    sizeof(stats_t))) == NULL)
+	    unix_error("calloc failed in eval_so_traces");
+	if (verbose > 1)
+	    printf("\nTesting libc malloc\n");
+	for (i = 0; i < num_tracefiles; i++)
+	    eval_libc_trace(tracefiles[i], i, &libc_stats[i]);
+    }
+
+    for (a = 0; a < nallocs; a++) {
+	if ((stats[a] = (stats_t *)calloc(num_tracefiles, 
+					  sizeof(stats_t))) == NULL)
+	    unix_error("calloc failed in eval_so_traces");
+	if (verbose > 1)
+	    printf("\nTesting %s\n", allocs[a].name);
+	mm = &allocs[a];
+	mm->mem_init();
+	if (nworkers > 1)
+	    eval_parallel(nworkers, tracefiles, num_tracefiles, NULL, 
+			  stats[a], 0);
+	else
+	    for (i = 0; i < num_tracefiles; i++)
+		eval_mm_trace(tracefiles[i], i, &stats[a][i], &ranges);
+	if (verbose) {
+	    printf("\nResults for %s:\n", allocs[a].name);
+	    printresults(num_tracefiles, stats[a]);
+	}
+    }
+    mm = &mm_builtin;
+
+    /* One column pair per allocator: util and Kops */
+    printf("\nResults for %d allocators:\n%5s", nallocs + run_libc, "");
+    for (a = 0; a < nallocs; a++)
+	printf("%14.13s", allocs[a].name);
+    if (run_libc)
+	printf("%14s", "libc");
+    printf("\n%5s", "trace");
+    for (a = 0; a < nallocs + run_libc; a++)
+	printf("%6s%8s", "util", "Kops");
+    printf("\n");
+    for (i = 0; i < num_tracefiles; i++) {
+	printf("%2d%3s", i, "");
+	for (a = 0; a < nallocs + run_libc; a++) {
+	    stats_t *s = (a < nallocs) ? &stats[a][i] : &libc_stats[i];
+
+	    if (!s->valid)
+		printf("%6s%8s", "-", "invalid");
+	    else if (a < nallocs)
+		printf("%5.0f%%%8.0f", s->util * 100.0, (s->ops/1e3)/s->secs);
+	    else
+		printf("%6s%8.0f", "-", (s->ops/1e3)/s->secs);
+	}
+	printf("\n");
+    }
+
+    /* The averages, and the performance index each allocator gets */
+    printf("%5s", "Total");
+    for (a = 0; a < nallocs + run_libc; a++) {
+	stats_t *s = (a < nallocs) ? stats[a] : libc_stats;
+
+	util = ops = secs = 0;
+	for (i = 0; i < num_tracefiles; i++) {
+	    util += s[i].util;
+	    ops += s[i].ops;
+	    secs += s[i].secs;
+	}
+	if (a < nallocs)
+	    printf("%5.0f%%%8.0f", (util/num_tracefiles)*100.0, 
+		   (ops/1e3)/secs);
+	else
+	    printf("%6s%8.0f", "-", (ops/1e3)/secs);
+    }
+    printf("\n%5s", "Perf");
+    for (a = 0; a < nallocs; a++)
+	printf("%14.0f", perf_index(num_tracefiles, stats[a]));
+    printf("\n");
+
+    for (a = 0; a < nallocs; a++)
+	free(stats[a]);
+    free(stats);
+    free(allocs);
+    free(libc_stats);
+}
+
+/*
+ * perf_index - The performance index (out of 100) of an allocator 
+ *     with these stats, or 0 if it got any trace wrong
+ */
+static double perf_index(int n, stats_t *stats)
+{
+    double util = 0, ops = 0, secs = 0, thru;
+    int i;
+
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    return 0;
+	util += stats[i].util;
+	ops += stats[i].ops;
+	secs += stats[i].secs;
+    }
+    thru = ops / secs;
+    if (thru > AVG_LIBC_THRUPUT)
+	thru = AVG_LIBC_THRUPUT;
+    return 100.0 * (UTIL_WEIGHT * (util/n) + 
+		    (1.0 - UTIL_WEIGHT) * (thru/AVG_LIBC_THRUPUT));
+}
+
+/*
+ * eval_pages - Time mm.c on each trace that it got right, once with
+ *     the heap on base pages and once on the pages chosen with --pages
+ *     (or, if that was "small", in a malloc'd heap), and print how the 
+ *     run time and, if the counters are available, the dTLB misses 
+ *     changed, along with the page size that each heap really got
+ */
+static void eval_pages(char **tracefiles, int num_tracefiles, 
+		       stats_t *mm_stats)
+{
+    static char *names[] = {"malloc", "small", "huge", "hugetlb"};
+    int modes[2];
+    size_t pagesize[2], huge_bytes[2], ps, hb;
+    double secs[2], tlb[2];
+    perfctr_t ctrs;
+    speed_t speed_params;
+    trace_t *trace;
+    int i, m, have_ctrs, no_tlb = 0;
+
+    modes[0] = (pages_mode == MEM_PAGES_SMALL) ? 
+	MEM_PAGES_MALLOC : MEM_PAGES_SMALL;
+    modes[1] = pages_mode;
+    pagesize[0] = pagesize[1] = huge_bytes[0] = huge_bytes[1] = 0;
+    have_ctrs = perf_ctrs || perfctr_init() > 0;
+
+    printf("\nHeap page size (--pages %s%s):\n", names[pages_mode],
+	   prefault ? " --prefault" : "");
+    printf("%5s%10s%10s%10s%10s%9s%10s\n", "trace", names[modes[0]], 
+	   "KdTLBmiss", names[modes[1]], "KdTLBmiss", "speedup", "dTLBdiff");
+    for (i = 0; i < num_tracefiles; i++) {
+	if (!mm_stats[i].valid) {
+	    printf("%2d%13s\n", i, "invalid");
+	    continue;
+	}
+	trace = read_trace(tracedir, tracefiles[i]);
+	speed_params.trace = trace;
+	speed_params.ranges = NULL;
+
+	for (m = 0; m < 2; m++) {
+	    mem_deinit();
+	    mem_set_pages(modes[m], prefault);
+	    mem_init();
+	    timing_begin();
+	    secs[m] = fsecs(eval_mm_speed, &speed_params);
+	    tlb[m] = -1;
+	    if (have_ctrs) {
+		fsecs_perf(eval_mm_speed, &speed_params, &ctrs);
+		if (ctrs.valid[PC_DTLB_MISS])
+		    tlb[m] = ctrs.count[PC_DTLB_MISS];
+	    }
+	    timing_end();
+	    if ((ps = mem_heap_pagesize(&hb)) > pagesize[m])
+		pagesize[m] = ps;
+	    if (hb > huge_bytes[m])
+		huge_bytes[m] = hb;
+	}
+
+	printf("%2d", i);
+	for (m = 0; m < 2; m++) {
+	    printf("%*.6f", m ? 10 : 13, secs[m]);
+	    if (tlb[m] >= 0)
+		printf("%10.1f", tlb[m]/1e3);
+	    else {
+		printf("%10s", "-");
+		no_tlb = 1;
+	    }
+	}
+	printf("%8.1f%%", 100.0 * (secs[0] - secs[1]) / secs[0]);
+	if (tlb[0] >= 0 && tlb[1] >= 0)
+	    printf("%10.1f\n", (tlb[1] - tlb[0])/1e3);
+	else
+	    printf("%10s\n", "-");
+	free_trace(trace);
+    }
+
+    for (m = 0; m < 2; m++)
+	printf("%s heap: %luK pages, %luK of %luK on huge pages\n",
+	       names[modes[m]], (unsigned long)pagesize[m] >> 10, 
+	       (unsigned long)huge_bytes[m] >> 10, 
+	       (unsigned long)MAX_HEAP >> 10);
+    if (no_tlb)
+	printf("(The dTLB miss counter is unavailable)\n");
+
+    /* Put the heap back the way the rest of the run expects it */
+    mem_deinit();
+    mem_set_pages(pages_mode, prefault);
+    mem_init();
+}
+
+/*****************************************************************
+ * The following routines check that mm.c can snapshot a heap that
+ * lives in a file and resume from it in a new process (--persist)
+ ****************************************************************/
+
+/*
+ * eval_persist_traces - For each trace, replay the first half in a 
+ *     child process with the heap in path, and snapshot it. Then, in
+ *     a second child, map the file, resume with mm_restore, check that
+ *     every live block kept its contents, and replay the rest of the 
+ *     trace. Print how long the first half took to build and how long
+ *     the restart took instead.
+ */
+static void eval_persist_traces(char *path, char **tracefiles, 
+				int num_tracefiles)
+{
+    trace_t *trace;
+    persist_t persist;
+    double build_secs, restart_secs;
+    int fd[2], i, id, live, status, ok;
+    size_t heapsize;
+    pid_t pid;
+
+    printf("\nWarm restart from a heap file (%s):\n", path);
+    printf("%5s%9s%8s%9s%11s%11s%8s\n", "trace", "snap op", "live", 
+	   "heap KB", "build secs", "restart", "check");
+    for (i = 0; i < num_tracefiles; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	persist.trace = trace;
+	persist.path = path;
+	persist.lo = 0;
+	persist.hi = trace->num_ops / 2;
+	memset(trace->block_sizes, 0, trace->num_ids * sizeof(size_t));
+
+	/* Build the first half of the heap and snapshot it */
+	if (pipe(fd) < 0)
+	    unix_error("pipe failed in eval_persist_traces");
+	fflush(stdout);
+	if ((pid = fork()) < 0)
+	    unix_error("fork failed in eval_persist_traces");
+	if (pid == 0) {
+	    close(fd[0]);
+	    unlink(path);
+	    mem_init_file(path);
+	    ok = (mm_init() >= 0);
+	    build_secs = ok ? ftimer_tsc(persist_replay, &persist, 1) : 0;
+	    if (!ok || !persist.ok || mm_snapshot() < 0)
+		exit(1);
+	    heapsize = mem_heapsize();
+	    if (write(fd[1], &build_secs, sizeof(double)) != sizeof(double) ||
+		write(fd[1], &heapsize, sizeof(size_t)) != sizeof(size_t) ||
+		write(fd[1], trace->blocks, trace->num_ids * sizeof(char *)) !=
+		trace->num_ids * sizeof(char *) ||
+		write(fd[1], trace->block_sizes, trace->num_ids * 
+		      sizeof(size_t)) != trace->num_ids * sizeof(size_t))
+		exit(1);
+	    exit(0);
+	}
+	close(fd[1]);
+	ok = (read_full(fd[0], &build_secs, sizeof(double)) &&
+	      read_full(fd[0], &heapsize, sizeof(size_t)) &&
+	      read_full(fd[0], trace->blocks, trace->num_ids * sizeof(char *)) &&
+	      read_full(fd[0], trace->block_sizes, 
+			trace->num_ids * sizeof(size_t)));
+	close(fd[0]);
+	waitpid(pid, &status, 0);
+	if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+	    malloc_error(i, persist.hi, "building and snapshotting the "
+			 "heap file failed");
+	    free_trace(trace);
+	    continue;
+	}
+	for (live = 0, id = 0; id < trace->num_ids; id++)
+	    if (trace->block_sizes[id] > 0)
+		live++;
+
+	/* Resume in a new process and finish the trace */
+	if (pipe(fd) < 0)
+	    unix_error("pipe failed in eval_persist_traces");
+	fflush(stdout);
+	if ((pid = fork()) < 0)
+	    unix_error("fork failed in eval_persist_traces");
+	if (pid == 0) {
+	    close(fd[0]);
+	    restart_secs = ftimer_tsc(persist_resume, &persist, 1);
+	    if (!persist.ok)
+		exit(2);
+	    if (!check_live_blocks(trace))
+		exit(3);
+	    persist.lo = persist.hi;
+	    persist.hi = trace->num_ops;
+	    persist_replay(&persist);
+	    if (!persist.ok || !check_live_blocks(trace))
+		exit(3);
+	    if (write(fd[1], &restart_secs, sizeof(double)) != sizeof(double))
+		exit(1);
+	    exit(0);
+	}
+	close(fd[1]);
+	ok = read_full(fd[0], &restart_secs, sizeof(double));
+	close(fd[0]);
+	waitpid(pid, &status, 0);
+
+	printf("%2d%12d%8d%9lu%11.6f", i, trace->num_ops / 2, live, 
+	       (unsigned long)(heapsize >> 10), build_secs);
+	if (ok && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+	    printf("%11.6f%8s\n", restart_secs, "ok");
+	else {
+	    printf("%11s%8s\n", "-", (WIFEXITED(status) &&
+				    WEXITSTATUS(status) == 3) ? "bad" : "failed");
+	    malloc_error(i, trace->num_ops / 2, 
+			 (WIFEXITED(status) && WEXITSTATUS(status) == 2) ?
+			 "mm_restore could not resume from the snapshot" :
+			 "blocks were lost or damaged across the restart");
+	}
+	free_trace(trace);
+    }
+    unlink(path);
+}
+
+/*
+ * persist_replay - Replay ops lo..hi-1 of a trace, filling each block 
+ *     with bytes derived from its id, and keeping track of the sizes
+ *     of the live blocks (0 once a block is freed)
+ */
+static void persist_replay(void *ptr)
+{
+    persist_t *pp = (persist_t *)ptr;
+    trace_t *trace = pp->trace;
+    int i, index, size;
+    char *p;
+
+    pp->ok = 0;
+    for (i = pp->lo; i < pp->hi; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm->malloc(size)) == NULL)
+		return;
+	    break;
+	case REALLOC:
+	    if ((p = mm->realloc(trace->blocks[index], size)) == NULL)
+		return;
+	    break;
+	default:
+	    mm->free(trace->blocks[index]);
+	    trace->block_sizes[index] = 0;
+	    continue;
+	}
+	memset(p, index & 0xFF, size);
+	trace->blocks[index] = p;
+	trace->block_sizes[index] = size;
+    }
+    pp->ok = 1;
+}
+
+/*
+ * persist_resume - Map the heap file and resume from its snapshot
+ */
+static void persist_resume(void *ptr)
+{
+    persist_t *pp = (persist_t *)ptr;
+
+    pp->ok = (mem_init_file(pp->path) == 1 && mm_restore() == 0);
+}
+
+/*
+ * check_live_blocks - Do all of the live blocks still hold the bytes 
+ *     that persist_replay filled them with?
+ */
+static int check_live_blocks(trace_t *trace)
+{
+    int id;
+    size_t j;
+
+    for (id = 0; id < trace->num_ids; id++)
+	for (j = 0; j < trace->block_sizes[id]; j++)
+	    if (trace->blocks[id][j] != (char)(id & 0xFF))
+		return 0;
+    return 1;
+}
+
+/*
+ * read_full - Read exactly n bytes from a pipe. Returns 0 if the
+ *     writer went away first.
+ */
+static int read_full(int fd, void *buf, size_t n)
+{
+    ssize_t got;
+
+    while (n > 0) {
+	if ((got = read(fd, buf, n)) <= 0)
+	    return 0;
+	buf = (char *)buf + got;
+	n -= got;
+    }
+    return 1;
+}
+
+/*****************************************************************
+ * The following routines save the results in machine-readable form
+ * and compare them against the results of an earlier run
+ ****************************************************************/
+
+/*
+ * write_results - Write the per-trace results for each package to
+ *     path, as CSV (one row per trace and package) or as JSON (with
+ *     one trace object per line, which is what compare_baseline reads)
+ */
+static void write_results(char *path, int csv, char **tracefiles, int n,
+			  stats_t *libc_stats, stats_t *mm_stats, 
+			  double perfindex)
+{
+    FILE *fp;
+    int i, j;
+
+    if ((fp = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %.900s in write_results", path);
+	unix_error(msg);
+    }
 
-	if (((*team.name2 != '\0') && (*team.id2 == '\0')) ||
-	    ((*team.name2 == '\0') && (*team.id2 != '\0'))) { 
-	    printf("ERROR.  You must fill in all or none of the team member 2 ID fields!\n");
-	    exit(1);
-	}
-	else if (*team.name2 != '\0')
-	    printf("Member 2 :%s:%s\n", team.name2, team.id2);
+    if (csv) {
+	fprintf(fp, "trace,allocator,valid,util,ops,secs,secs_sd,"
+		"secs_median,secs_ci95,samples,Kops,secs_cold");
+	for (j = 0; j < PC_NUM; j++)
+	    fprintf(fp, ",%s", perfctr_names[j]);
+	fprintf(fp, "\n");
     }
+    else
+	fprintf(fp, "{\n\"perfindex\": %.2f,\n\"traces\": [\n", perfindex);
 
-    /* 
-     * If no -f command line arg, then use the entire set of tracefiles 
-     * defined in default_traces[]
-     */
-    if (tracefiles == NULL) {
-        tracefiles = default_tracefiles;
-        num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
-	printf("Using default tracefiles in %s\n", tracedir);
+    for (i = 0; i < n; i++) {
+	if (libc_stats)
+	    write_stats(fp, csv, tracefiles[i], "libc", &libc_stats[i], 0);
+	write_stats(fp, csv, tracefiles[i], "mm", &mm_stats[i], i == n-1);
     }
 
-    /* Initialize the timing package */
-    init_fsecs();
+    if (!csv)
+	fprintf(fp, "]\n}\n");
+    fclose(fp);
+}
 
-    /*
-     * Optionally run and evaluate the libc malloc package 
-     */
-    if (run_libc) {
-	if (verbose > 1)
-	    printf("\nTesting libc malloc\n");
-	
-	/* Allocate libc stats array, with one stats_t struct per tracefile */
-	libc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-	if (libc_stats == NULL)
-	    unix_error("libc_stats calloc in main failed");
-	
-	/* Evaluate the libc malloc package using the K-best scheme */
-	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
-	    if (verbose > 1)
-		printf("Checking libc malloc for correctness, ");
-	    libc_stats[i].valid = eval_libc_valid(trace, i);
-	    if (libc_stats[i].valid) {
-		speed_params.trace = trace;
-		if (verbose > 1)
-		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
-	    }
-	    free_trace(trace);
-	}
+/*
+ * write_json_string - Write s as a JSON string, escaping quotes and
+ *     backslashes
+ */
+static void write_json_string(FILE *fp, char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+	if (*s == '"' || *s == '\\')
+	    fputc('\\', fp);
+	fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
 
-	/* Display the libc results in a compact table */
-	if (verbose) {
-	    printf("\nResults for libc malloc:\n");
-	    printresults(num_tracefiles, libc_stats);
+/*
+ * write_csv_field - Write s as a CSV field, in quotes (with any quotes
+ *     in it doubled) if it has a comma or a quote
+ */
+static void write_csv_field(FILE *fp, char *s)
+{
+    if (strpbrk(s, ",\"") == NULL) {
+	fputs(s, fp);
+	return;
+    }
+    fputc('"', fp);
+    for (; *s; s++) {
+	if (*s == '"')
+	    fputc('"', fp);
+	fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * write_stats - Write one trace's results for one package. Hardware
+ *     event counts are written in the same units as printresults uses,
+ *     and only for the events that were counted.
+ */
+static void write_stats(FILE *fp, int csv, char *tracefile, char *allocator,
+			stats_t *stats, int last)
+{
+    double kops = stats->valid ? (stats->ops/1e3)/stats->secs : 0;
+    double count[PC_NUM];
+    int j;
+
+    for (j = 0; j < PC_NUM; j++)
+	count[j] = (j == PC_PAGE_FAULTS) ? 
+	    stats->ctrs.count[j] : stats->ctrs.count[j]/1e3;
+
+    if (csv) {
+	write_csv_field(fp, tracefile);
+	fprintf(fp, ",%s,%d,%.6f,%.0f,%.9f,%.9f,%.9f,%.9f,%d,%.3f,%.9f", 
+		allocator, stats->valid, stats->util, stats->ops,
+		stats->secs, stats->secs_sd, stats->secs_median, 
+		stats->secs_ci95, stats->nsamples, kops, stats->secs_cold);
+	for (j = 0; j < PC_NUM; j++) {
+	    if (stats->ctrs.valid[j])
+		fprintf(fp, ",%.3f", count[j]);
+	    else
+		fprintf(fp, ",");
 	}
+	fprintf(fp, "\n");
     }
+    else {
+	fprintf(fp, "{\"trace\": ");
+	write_json_string(fp, tracefile);
+	fprintf(fp, ", \"allocator\": \"%s\", "
+		"\"valid\": %d, \"util\": %.6f, \"ops\": %.0f, "
+		"\"secs\": %.9f, \"secs_sd\": %.9f, \"secs_median\": %.9f, "
+		"\"secs_ci95\": %.9f, \"samples\": %d, \"Kops\": %.3f, "
+		"\"secs_cold\": %.9f",
+		allocator, stats->valid, stats->util, stats->ops,
+		stats->secs, stats->secs_sd, stats->secs_median, 
+		stats->secs_ci95, stats->nsamples, kops, stats->secs_cold);
+	for (j = 0; j < PC_NUM; j++)
+	    if (stats->ctrs.valid[j])
+		fprintf(fp, ", \"%s\": %.3f", perfctr_names[j], count[j]);
+	fprintf(fp, "}%s\n", last ? "" : ",");
+    }
+}
 
-    /*
-     * Always run and evaluate the student's mm package
-     */
-    if (verbose > 1)
-	printf("\nTesting mm malloc\n");
+/* The mm results for one trace of a baseline run */
+typedef struct {
+    char trace[MAXLINE];
+    int valid;
+    double util;
+    double secs;
+    double secs_sd;
+    int nsamples;
+} baseline_t;
 
-    /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
-	unix_error("mm_stats calloc in main failed");
-    
-    /* Initialize the simulated memory system in memlib.c */
-    mem_init(); 
+/*
+ * json_field - Find "name": in a line written by write_stats, and 
+ *     return a pointer to its value (or NULL)
+ */
+static char *json_field(char *line, char *name)
+{
+    char key[MAXLINE];
+    char *p;
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+    sprintf(key, "\"%s\":", name);
+    if ((p = strstr(line, key)) == NULL)
+	return NULL;
+    p += strlen(key);
+    while (*p == ' ')
+	p++;
+    return p;
+}
+
+/*
+ * json_string - Copy the JSON string at p, without its quotes and
+ *     escapes, into buf of size n. Returns 0 if p is not a string.
+ */
+static int json_string(char *p, char *buf, int n)
+{
+    int i = 0;
+
+    if (p == NULL || *p++ != '"')
+	return 0;
+    for (; *p && *p != '"'; p++) {
+	if (*p == '\\' && p[1] != '\0')
+	    p++;
+	if (i < n-1)
+	    buf[i++] = *p;
+    }
+    buf[i] = '\0';
+    return 1;
+}
+
+/*
+ * csv_split - Split a CSV line in place into at most max fields,
+ *     removing the quotes from quoted ones. Returns the number of fields.
+ */
+static int csv_split(char *line, char **field, int max)
+{
+    char *p = line, *q;
+    char c;
+    int n = 0;
+
+    while (n < max) {
+	field[n++] = q = p;
+	if (*p == '"') {
+	    /* Copy the quoted text down over the quotes */
+	    for (p++; *p; p++) {
+		if (*p == '"' && *++p != '"')
+		    break;
+		*q++ = *p;
+	    }
 	}
-	free_trace(trace);
+	else
+	    while (*p && *p != ',')
+		*q++ = *p++;
+	while (*p && *p != ',')
+	    p++;
+	c = *p++;
+	*q = '\0';
+	if (c == '\0')
+	    break;
     }
+    return n;
+}
 
-    /* Display the mm results in a compact table */
-    if (verbose) {
-	printf("\nResults for mm malloc:\n");
-	printresults(num_tracefiles, mm_stats);
-	printf("\n");
+/*
+ * read_baseline - Read the mm results from a file written with --json
+ *     or --csv. Returns the number of traces read into base[].
+ */
+static int read_baseline(char *path, baseline_t *base, int maxtraces)
+{
+    FILE *fp;
+    char line[MAXLINE];
+    char *field[MAXLINE/2];
+    char *p;
+    int col_trace = -1, col_alloc = -1, col_valid = -1, col_util = -1;
+    int col_secs = -1, col_sd = -1, col_samples = -1;
+    int n = 0, json = 0, nfields, j;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %.900s in read_baseline", path);
+	unix_error(msg);
     }
 
-    /* 
-     * Accumulate the aggregate statistics for the student's mm package 
-     */
-    secs = 0;
-    ops = 0;
-    util = 0;
-    numcorrect = 0;
-    for (i=0; i < num_tracefiles; i++) {
-	secs += mm_stats[i].secs;
-	ops += mm_stats[i].ops;
-	util += mm_stats[i].util;
-	if (mm_stats[i].valid)
-	    numcorrect++;
+    while (n < maxtraces && fgets(line, MAXLINE, fp) != NULL) {
+	line[strcspn(line, "\r\n")] = '\0';
+	if (line[0] == '{' && strstr(line, "\"trace\"") == NULL) {
+	    json = 1;  /* the opening brace of a JSON file */
+	    continue;
+	}
+
+	if (json || line[0] == '{') {
+	    /* One JSON trace object per line */
+	    if ((p = json_field(line, "allocator")) == NULL || 
+		strncmp(p, "\"mm\"", 4) != 0)
+		continue;
+	    if (!json_string(json_field(line, "trace"), base[n].trace, MAXLINE))
+		continue;
+	    base[n].valid = (p = json_field(line, "valid")) ? atoi(p) : 0;
+	    base[n].util = (p = json_field(line, "util")) ? atof(p) : 0;
+	    base[n].secs = (p = json_field(line, "secs")) ? atof(p) : 0;
+	    base[n].secs_sd = (p = json_field(line, "secs_sd")) ? atof(p) : 0;
+	    base[n].nsamples = (p = json_field(line, "samples")) ? atoi(p) : 1;
+	    n++;
+	    continue;
+	}
+
+	/* CSV: split the line at the commas */
+	nfields = csv_split(line, field, MAXLINE/2);
+	if (col_trace < 0) {
+	    /* The header row tells us where the columns are */
+	    for (j = 0; j < nfields; j++) {
+		if (!strcmp(field[j], "trace")) col_trace = j;
+		else if (!strcmp(field[j], "allocator")) col_alloc = j;
+		else if (!strcmp(field[j], "valid")) col_valid = j;
+		else if (!strcmp(field[j], "util")) col_util = j;
+		else if (!strcmp(field[j], "secs")) col_secs = j;
+		else if (!strcmp(field[j], "secs_sd")) col_sd = j;
+		else if (!strcmp(field[j], "samples")) col_samples = j;
+	    }
+	    if (col_trace < 0 || col_alloc < 0 || col_util < 0 || 
+		col_secs < 0 || col_valid < 0) {
+		sprintf(msg, "Baseline %.900s is neither --json nor --csv output", 
+			path);
+		app_error(msg);
+	    }
+	    continue;
+	}
+	if (nfields <= col_secs || strcmp(field[col_alloc], "mm") != 0)
+	    continue;
+	strncpy(base[n].trace, field[col_trace], MAXLINE-1);
+	base[n].trace[MAXLINE-1] = '\0';
+	base[n].valid = atoi(field[col_valid]);
+	base[n].util = atof(field[col_util]);
+	base[n].secs = atof(field[col_secs]);
+	base[n].secs_sd = (col_sd >= 0 && col_sd < nfields) ? 
+	    atof(field[col_sd]) : 0;
+	base[n].nsamples = (col_samples >= 0 && col_samples < nfields) ? 
+	    atoi(field[col_samples]) : 1;
+	n++;
     }
-    avg_mm_util = util/num_tracefiles;
+    fclose(fp);
+    return n;
+}
 
-    /* 
-     * Compute and print the performance index 
-     */
-    if (errors == 0) {
-	avg_mm_throughput = ops/secs;
+/*
+ * t_critical - One-sided 95% critical value of Student's t 
+ *     distribution with df degrees of freedom
+ */
+static double t_critical(double df)
+{
+    static double table[30] = {
+	6.314, 2.920, 2.353, 2.132, 2.015, 1.943, 1.895, 1.860, 1.833, 1.812,
+	1.796, 1.782, 1.771, 1.761, 1.753, 1.746, 1.740, 1.734, 1.729, 1.725,
+	1.721, 1.717, 1.714, 1.711, 1.708, 1.706, 1.703, 1.701, 1.699, 1.697
+    };
+    int i = (int)df;
+
+    if (i < 1)
+	i = 1;
+    return (i <= 30) ? table[i-1] : 1.645;
+}
 
-	p1 = UTIL_WEIGHT * avg_mm_util;
-	if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
-	    p2 = (double)(1.0 - UTIL_WEIGHT);
-	} 
-	else {
-	    p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
-		(avg_mm_throughput/AVG_LIBC_THRUPUT);
+/*
+ * compare_baseline - Compare the mm results against a baseline run and
+ *     report the regressions. A trace regresses if it was valid and no
+ *     longer is, if its utilization drops by more than half a percent,
+ *     or if it got more than threshold percent slower and Welch's t 
+ *     test says that the slowdown is significant at the 95% level. 
+ *     With too few samples on either side to test, the threshold alone
+ *     decides. Returns the number of regressions.
+ */
+static int compare_baseline(char *path, char **tracefiles, int n, 
+			    stats_t *mm_stats)
+{
+    baseline_t *base;
+    int nbase, i, b, regressions = 0;
+    double change, se, t, df, v0, v1;
+    char *verdict;
+
+    if ((base = (baseline_t *)malloc(n * sizeof(baseline_t))) == NULL)
+	unix_error("malloc failed in compare_baseline");
+    nbase = read_baseline(path, base, n);
+
+    printf("\nComparison with baseline %s:\n", path);
+    printf("%-20s%7s%7s%10s%10s%8s%7s  %s\n", "trace", "util", "base",
+	   "Kops", "base", "change", "t", "verdict");
+    for (i = 0; i < n; i++) {
+	for (b = 0; b < nbase && strcmp(base[b].trace, tracefiles[i]); b++)
+	    ;
+	if (b == nbase || !base[b].valid) {
+	    printf("%-20s%7s%7s%10s%10s%8s%7s  %s\n", tracefiles[i], 
+		   "-", "-", "-", "-", "-", "-", "not in baseline");
+	    continue;
 	}
-	
-	perfindex = (p1 + p2)*100.0;
-	printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
-	       p1*100, 
-	       p2*100, 
-	       perfindex);
-	
+	if (!mm_stats[i].valid) {
+	    printf("%-20s%7s%6.0f%%%10s%10.0f%8s%7s  %s\n", tracefiles[i], 
+		   "-", base[b].util*100.0, "-", 
+		   (mm_stats[i].ops/1e3)/base[b].secs, "-", "-", 
+		   "REGRESSION (invalid)");
+	    regressions++;
+	    continue;
+	}
+
+	/* Relative change in time (positive = slower) and Welch's t */
+	change = (mm_stats[i].secs - base[b].secs) / base[b].secs * 100.0;
+	t = 0;
+	df = 0;
+	if (mm_stats[i].nsamples > 1 && base[b].nsamples > 1) {
+	    v1 = mm_stats[i].secs_sd * mm_stats[i].secs_sd / 
+		mm_stats[i].nsamples;
+	    v0 = base[b].secs_sd * base[b].secs_sd / base[b].nsamples;
+	    se = sqrt(v0 + v1);
+	    if (se > 0) {
+		t = (mm_stats[i].secs - base[b].secs) / se;
+		df = (v0 + v1) * (v0 + v1) / 
+		    (v1 * v1 / (mm_stats[i].nsamples - 1) + 
+		     v0 * v0 / (base[b].nsamples - 1));
+	    }
+	    else
+		t = (mm_stats[i].secs > base[b].secs) ? HUGE_VAL : 0;
+	}
+
+	verdict = "ok";
+	if (mm_stats[i].util < base[b].util - 0.005)
+	    verdict = "REGRESSION (util)";
+	else if (change > threshold && 
+		 (df == 0 && t == 0 ? 1 : t > t_critical(df)))
+	    verdict = "REGRESSION (speed)";
+	else if (change < -threshold && 
+		 (df == 0 && t == 0 ? 1 : -t > t_critical(df)))
+	    verdict = "improved";
+	if (!strncmp(verdict, "REGRESSION", 10))
+	    regressions++;
+
+	printf("%-20s%6.0f%%%6.0f%%%10.0f%10.0f%+7.1f%%%7.2f  %s\n", 
+	       tracefiles[i], mm_stats[i].util*100.0, base[b].util*100.0,
+	       (mm_stats[i].ops/1e3)/mm_stats[i].secs, 
+	       (mm_stats[i].ops/1e3)/base[b].secs, change, t, verdict);
     }
-    else { /* There were errors */
-	perfindex = 0.0;
-	printf("Terminated with %d errors\n", errors);
+    printf("%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+
+    free(base);
+    return regressions;
+}
+
+/*****************************************************************
+ * The following routines profile the heap while eval_mm_util replays
+ * a trace, to show when and where fragmentation builds up
+ ****************************************************************/
+
+/* Heap statistics accumulated by a walk over the heap */
+typedef struct {
+    int free_blocks;      /* number of free blocks */
+    size_t free_bytes;    /* total size of the free blocks */
+    size_t largest_free;  /* size of the largest free block */
+} heapstats_t;
+
+/* Where the current heap map run started, and its state */
+typedef struct {
+    int tracenum, opnum;
+    char *run_lo;         /* first byte of the current run */
+    size_t run_bytes;     /* length of the current run */
+    int run_alloc;        /* is the current run allocated? */
+} heapmap_t;
+
+/*
+ * open_profile - Open the timeline file at path and, if heapmap_list
+ *     (a comma-separated list of op numbers) is given, the heap map 
+ *     file path.map. Both files are CSV.
+ */
+static void open_profile(char *path, char *heapmap_list)
+{
+    char mappath[MAXLINE];
+    char *p;
+
+    if ((timeline_fp = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %.900s in open_profile", path);
+	unix_error(msg);
+    }
+    fprintf(timeline_fp, "trace,op,live_bytes,heap_bytes,util,free_blocks,"
+	    "free_bytes,largest_free,ext_frag\n");
+
+    if (heapmap_list == NULL)
+	return;
+    for (p = heapmap_list, num_heapmap_ops = 1; *p; p++)
+	if (*p == ',')
+	    num_heapmap_ops++;
+    if ((heapmap_ops = (int *)malloc(num_heapmap_ops * sizeof(int))) == NULL)
+	unix_error("malloc failed in open_profile");
+    for (p = strtok(heapmap_list, ","), num_heapmap_ops = 0; p != NULL; 
+	 p = strtok(NULL, ","))
+	heapmap_ops[num_heapmap_ops++] = atoi(p);
+
+    snprintf(mappath, MAXLINE, "%s.map", path);
+    if ((heapmap_fp = fopen(mappath, "w")) == NULL) {
+	snprintf(msg, MAXLINE, "Could not open %.900s in open_profile", mappath);
+	unix_error(msg);
     }
+    fprintf(heapmap_fp, "trace,op,offset,bytes,state\n");
+}
 
-    if (autograder) {
-	printf("correct:%d\n", numcorrect);
-	printf("perfidx:%.0f\n", perfindex);
+/* heapstats_visit - mm_heapwalk visitor that tallies the free blocks */
+static void heapstats_visit(void *block, size_t size, int alloc, void *arg)
+{
+    heapstats_t *hs = (heapstats_t *)arg;
+
+    if (!alloc) {
+	hs->free_blocks++;
+	hs->free_bytes += size;
+	if (size > hs->largest_free)
+	    hs->largest_free = size;
+    }
+}
+
+/*
+ * sample_heap - Write one timeline sample, taken after request opnum.
+ *     External fragmentation is the fraction of free memory that is
+ *     not in the largest free block, i.e., that couldn't be used by
+ *     one large request.
+ */
+static void sample_heap(int tracenum, int opnum, int live_bytes)
+{
+    heapstats_t hs;
+    size_t heap_bytes = mm->mem_heapsize();
+
+    memset(&hs, 0, sizeof(hs));
+    mm->heapwalk(heapstats_visit, &hs);
+    fprintf(timeline_fp, "%d,%d,%d,%lu,%.4f,%d,%lu,%lu,%.4f\n", 
+	    tracenum, opnum, live_bytes, (unsigned long)heap_bytes,
+	    heap_bytes ? (double)live_bytes / heap_bytes : 0.0,
+	    hs.free_blocks, (unsigned long)hs.free_bytes, 
+	    (unsigned long)hs.largest_free,
+	    hs.free_bytes ? 1.0 - (double)hs.largest_free / hs.free_bytes : 0.0);
+}
+
+/* heapmap_flush - Write out the current run of a heap map */
+static void heapmap_flush(heapmap_t *hm)
+{
+    if (hm->run_bytes > 0)
+	fprintf(heapmap_fp, "%d,%d,%lu,%lu,%s\n", hm->tracenum, hm->opnum,
+		(unsigned long)(hm->run_lo - (char *)mm->mem_heap_lo()),
+		(unsigned long)hm->run_bytes, hm->run_alloc ? "alloc" : "free");
+}
+
+/* heapmap_visit - mm_heapwalk visitor that merges blocks into runs */
+static void heapmap_visit(void *block, size_t size, int alloc, void *arg)
+{
+    heapmap_t *hm = (heapmap_t *)arg;
+
+    if (hm->run_bytes > 0 && alloc == hm->run_alloc && 
+	(char *)block == hm->run_lo + hm->run_bytes) {
+	hm->run_bytes += size;
+	return;
     }
+    heapmap_flush(hm);
+    hm->run_lo = (char *)block;
+    hm->run_bytes = size;
+    hm->run_alloc = alloc;
+}
+
+/*
+ * dump_heapmap - Write the heap as a list of allocated and free runs
+ *     (adjacent blocks in the same state), taken after request opnum
+ */
+static void dump_heapmap(int tracenum, int opnum)
+{
+    heapmap_t hm;
 
-    exit(0);
+    memset(&hm, 0, sizeof(hm));
+    hm.tracenum = tracenum;
+    hm.opnum = opnum;
+    mm->heapwalk(heapmap_visit, &hm);
+    heapmap_flush(&hm);
 }
 
+/* is_heapmap_op - Should we dump a heap map after request opnum? */
+static int is_heapmap_op(int opnum)
+{
+    int i;
+
+    for (i = 0; i < num_heapmap_ops; i++)
+	if (heapmap_ops[i] == opnum)
+	    return 1;
+    return 0;
+}
 
 /*****************************************************************
  * The following routines manipulate the range list, which keeps 
@@ -396,10 +3099,10 @@ static int add_range(range_t **ranges, char *lo, int size,
     }
 
     /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    if ((lo < (char *)mm->mem_heap_lo()) || (lo > (char *)mm->mem_heap_hi()) || 
+	(hi < (char *)mm->mem_heap_lo()) || (hi > (char *)mm->mem_heap_hi())) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
-		lo, hi, mem_heap_lo(), mem_heap_hi());
+		lo, hi, mm->mem_heap_lo(), mm->mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
@@ -475,11 +3178,15 @@ static trace_t *read_trace(char *tracedir, char *filename)
 {
     FILE *tracefile;
     trace_t *trace;
+    char line[MAXLINE];
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    char *opt, *hint;
+    unsigned index, size, tid;
+    int flags;
     unsigned max_index = 0;
     unsigned op_index;
+    int nfields, len;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -515,37 +3222,82 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
     
-    /* read every request line in the trace file */
+    /* 
+     * Read every request line in the trace file. After its usual 
+     * fields, a request may carry optional "key=value" fields:
+     *     t=<tid>   thread that issues the request (default 0)
+     *     h=<hints> MM_HINT_* flags of an alloc, as letters (see mm.h)
+     */
     index = 0;
     op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
+    trace->num_threads = 1;
+    while (fgets(line, MAXLINE, tracefile) != NULL) {
+	if (sscanf(line, "%s", type) != 1)
+	    continue; /* skip blank lines */
+	if (op_index >= trace->num_ops) {
+	    printf("Too many requests in tracefile %s\n", path);
+	    exit(1);
+	}
+	size = 0;
+	len = 0;
 	switch(type[0]) {
 	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
+	    nfields = sscanf(line, "%*s %u %u%n", &index, &size, &len);
 	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
+	    nfields = sscanf(line, "%*s %u %u%n", &index, &size, &len);
 	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'f':
-	    fscanf(tracefile, "%ud", &index);
+	    nfields = sscanf(line, "%*s %u%n", &index, &len) + 1;
 	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
 	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
 		   type[0], path);
 	    exit(1);
 	}
+	if (nfields != 2) {
+	    printf("Malformed request (%s) in tracefile %s\n", type, path);
+	    exit(1);
+	}
+	trace->ops[op_index].index = index;
+	trace->ops[op_index].size = size;
+	trace->ops[op_index].tid = 0;
+	trace->ops[op_index].hint = 0;
+
+	/* Parse the optional fields */
+	for (opt = strtok(line + len, " \t\r\n"); opt != NULL; 
+	     opt = strtok(NULL, " \t\r\n")) {
+	    if (sscanf(opt, "t=%u", &tid) == 1) {
+		trace->ops[op_index].tid = tid;
+		if (tid + 1 > trace->num_threads)
+		    trace->num_threads = tid + 1;
+	    }
+	    else if (!strncmp(opt, "h=", 2) && type[0] == 'a') {
+		for (hint = opt + 2; *hint; hint++) {
+		    switch (*hint) {
+		    case 's': flags = MM_HINT_SHORT; break;
+		    case 'l': flags = MM_HINT_LONG; break;
+		    case 'h': flags = MM_HINT_HOT; break;
+		    case 'c': flags = MM_HINT_COLD; break;
+		    case 'r': flags = MM_HINT_REALLOC; break;
+		    default:
+			printf("Bogus hint (%s) in tracefile %s\n", opt, path);
+			exit(1);
+		    }
+		    trace->ops[op_index].hint |= flags;
+		}
+	    }
+	    else {
+		printf("Bogus field (%s) in tracefile %s\n", opt, path);
+		exit(1);
+	    }
+	}
 	op_index++;
-	
     }
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
@@ -571,6 +3323,17 @@ void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * mm_alloc - Allocate the block for an alloc request, through 
+ *     mm_malloc_hinted if the request has hints and we're using them
+ */
+static void *mm_alloc(traceop_t *op)
+{
+    if (op->hint && use_hints && mm->malloc_hinted != NULL)
+	return mm->malloc_hinted(op->size, op->hint);
+    return mm->malloc(op->size);
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
@@ -585,11 +3348,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *p;
     
     /* Reset the heap and free any records in the range list */
-    mem_reset_brk();
+    mm->mem_reset_brk();
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (mm->init() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
@@ -604,7 +3367,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    if ((p = mm_alloc(&trace->ops[i])) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -633,7 +3396,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+	    if ((newp = mm->realloc(oldp, size)) == NULL) {
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
@@ -653,7 +3416,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if (newp[j] != (char)(index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -671,7 +3434,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    mm->free(p);
 	    break;
 
 	default:
@@ -706,8 +3469,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     char *newp, *oldp;
 
     /* initialize the heap and the mm malloc package */
-    mem_reset_brk();
-    if (mm_init() < 0)
+    mm->mem_reset_brk();
+    if (mm->init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -717,7 +3480,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = mm_alloc(&trace->ops[i])) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -739,7 +3502,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    if ((newp = mm->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -760,7 +3523,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    mm->free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -772,9 +3535,16 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+
+	/* Profile the heap as it evolves (--timeline, --heapmap) */
+	if (timeline_fp && 
+	    (i % timeline_every == 0 || i == trace->num_ops - 1))
+	    sample_heap(tracenum, i, total_size);
+	if (heapmap_fp && is_heapmap_op(i))
+	    dump_heapmap(tracenum, i);
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mm->mem_heapsize());
 }
 
 
@@ -784,13 +3554,13 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    int i, index, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     /* Reset the heap and initialize the mm package */
-    mem_reset_brk();
-    if (mm_init() < 0) 
+    mm->mem_reset_brk();
+    if (mm->init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
@@ -799,8 +3569,7 @@ static void eval_mm_speed(void *ptr)
 
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = mm_alloc(&trace->ops[i])) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -809,7 +3578,7 @@ static void eval_mm_speed(void *ptr)
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            if ((newp = mm->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
             break;
@@ -817,7 +3586,7 @@ static void eval_mm_speed(void *ptr)
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            mm->free(block);
             break;
 
 	default:
@@ -924,54 +3693,124 @@ static void printresults(int n, stats_t *stats)
     double secs = 0;
     double ops = 0;
     double util = 0;
+    double secs_cold = 0;
+
+    perfctr_t total;
+    int j;
+    int show_ci = 0; /* show the spread if the traces were sampled */
+    int show_cold = (cache_mode == CACHE_BOTH); /* show cold cache times */
+
+    memset(&total, 0, sizeof(total));
+    for (j = 0; j < PC_NUM; j++)
+	total.valid[j] = 1;
+    for (i=0; i < n; i++)
+	if (stats[i].valid && stats[i].nsamples > 1)
+	    show_ci = 1;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
+    printf("%5s%7s %5s%8s%10s%6s", 
 	   "trace", " valid", "util", "ops", "secs", "Kops");
+    if (show_ci)
+	printf("%10s%7s", "median", "+-ci95");
+    if (show_cold)
+	printf("%10s%6s", "coldsecs", "Kops");
+    if (perf_ctrs)
+	for (j = 0; j < PC_NUM; j++)
+	    printf("%11s", perfctr_names[j]);
+    printf("\n");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
+	    if (show_ci)
+		printf("%10.6f%6.1f%%", stats[i].secs_median,
+		       100.0 * stats[i].secs_ci95 / stats[i].secs);
+	    if (show_cold)
+		printf("%10.6f%6.0f", stats[i].secs_cold,
+		       (stats[i].ops/1e3)/stats[i].secs_cold);
 	    secs += stats[i].secs;
+	    secs_cold += stats[i].secs_cold;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
+	    for (j = 0; j < PC_NUM; j++) {
+		total.valid[j] &= stats[i].ctrs.valid[j];
+		total.count[j] += stats[i].ctrs.count[j];
+	    }
+	    printctrs(&stats[i].ctrs);
 	}
 	else {
-	    printf("%2d%10s%6s%8s%10s%6s\n", 
+	    printf("%2d%10s%6s%8s%10s%6s", 
 		   i,
 		   "no",
 		   "-",
 		   "-",
 		   "-",
 		   "-");
+	    if (show_ci)
+		printf("%10s%7s", "-", "-");
+	    if (show_cold)
+		printf("%10s%6s", "-", "-");
+	    printctrs(NULL);
 	}
     }
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	printf("%12s%5.0f%%%8.0f%10.6f%6.0f", 
 	       "Total       ",
 	       (util/n)*100.0,
 	       ops, 
 	       secs,
 	       (ops/1e3)/secs);
+	if (show_ci)
+	    printf("%10s%7s", "", "");
+	if (show_cold)
+	    printf("%10.6f%6.0f", secs_cold, (ops/1e3)/secs_cold);
+	printctrs(&total);
     }
     else {
-	printf("%12s%6s%8s%10s%6s\n", 
+	printf("%12s%6s%8s%10s%6s", 
 	       "Total       ",
 	       "-", 
 	       "-", 
 	       "-", 
 	       "-");
+	if (show_ci)
+	    printf("%10s%7s", "", "");
+	if (show_cold)
+	    printf("%10s%6s", "-", "-");
+	printctrs(NULL);
     }
 
 }
 
+/*
+ * printctrs - finish a printresults row with the hardware event counts
+ *     (in thousands, except for page faults), if -p was given. Events
+ *     that could not be counted are shown as "-".
+ */
+static void printctrs(perfctr_t *ctrs)
+{
+    int j;
+
+    if (perf_ctrs) {
+	for (j = 0; j < PC_NUM; j++) {
+	    if (ctrs == NULL || !ctrs->valid[j])
+		printf("%11s", "-");
+	    else if (j == PC_PAGE_FAULTS)
+		printf("%11.0f", ctrs->count[j]);
+	    else
+		printf("%11.0f", ctrs->count[j]/1e3);
+	}
+    }
+    printf("\n");
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1004,14 +3843,64 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValp] [-f <file>] [-t <dir>] [-j <n>]\n");
+    fprintf(stderr, "               [-T <n> [-B <ops>]] [--json <file>] [--csv <file>]\n");
+    fprintf(stderr, "               [--baseline <file>] [--repeat <n>] [--threshold <pct>]\n");
+    fprintf(stderr, "               [--timeline <file> [--every <n>] [--heapmap <op,...>]]\n");
+    fprintf(stderr, "               [--ab] [--cpu <n>] [--cache warm|cold|both]\n");
+    fprintf(stderr, "               [--touch recent|random|id [--touches <n>]]\n");
+    fprintf(stderr, "               [--so <lib.so> ...] [--pages <kind> [--prefault]]\n");
+    fprintf(stderr, "               [--persist <file>] [--hot <n>x<bytes>] [--hints]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-B <ops>   With -T, sync threads every <ops> requests.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to <n> traces in parallel.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-p         Count hardware events for each trace.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Replay each trace on 1..<n> threads.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t--json <file>     Also write the results to <file> as JSON.\n");
+    fprintf(stderr, "\t--csv <file>      Also write the results to <file> as CSV.\n");
+    fprintf(stderr, "\t--baseline <file> Compare against a saved --json/--csv run;\n");
+    fprintf(stderr, "\t                  exit with status 2 on any regression.\n");
+    fprintf(stderr, "\t--repeat <n>      Time each trace at least <n> times (default 1,\n");
+    fprintf(stderr, "\t                  or 5 with --baseline). The fbench timer\n");
+    fprintf(stderr, "\t                  keeps going until the 95%% CI is within 1%%.\n");
+    fprintf(stderr, "\t--threshold <pct> Ignore slowdowns under <pct>%% (default 5).\n");
+    fprintf(stderr, "\t--timeline <file> Write heap size and fragmentation samples\n");
+    fprintf(stderr, "\t                  to <file> as CSV.\n");
+    fprintf(stderr, "\t--every <n>       Take a sample every <n> requests (default 100).\n");
+    fprintf(stderr, "\t--heapmap <op,..> Write the heap's allocated and free runs after\n");
+    fprintf(stderr, "\t                  each listed request to <file>.map.\n");
+    fprintf(stderr, "\t--ab              With -l, time libc and mm malloc in\n");
+    fprintf(stderr, "\t                  interleaved trials.\n");
+    fprintf(stderr, "\t--cpu <n>         Pin the timing runs to cpu <n>.\n");
+    fprintf(stderr, "\t--cache <mode>    Start each timed run with a warm cache, a\n");
+    fprintf(stderr, "\t                  cold one, or time both ways.\n");
+    fprintf(stderr, "\t--touch <pattern> Replay writing every new payload and touching\n");
+    fprintf(stderr, "\t                  recent, random or id-ordered live blocks after\n");
+    fprintf(stderr, "\t                  each request; report speed and cache misses.\n");
+    fprintf(stderr, "\t--touches <n>     Touch <n> blocks per request (default 4).\n");
+    fprintf(stderr, "\t--so <lib.so>     Also evaluate the allocator in <lib.so> (see\n");
+    fprintf(stderr, "\t                  \"make foo.so\"), and print the results of\n");
+    fprintf(stderr, "\t                  mm.c and each --so side by side.\n");
+    fprintf(stderr, "\t--pages <kind>    Back the heap with malloc (default), or mmap\n");
+    fprintf(stderr, "\t                  it 2MB-aligned on small, huge (THP) or\n");
+    fprintf(stderr, "\t                  hugetlb pages; compare the speed and dTLB\n");
+    fprintf(stderr, "\t                  misses with small pages.\n");
+    fprintf(stderr, "\t--prefault        Fault the whole heap in before using it.\n");
+    fprintf(stderr, "\t--persist <file>  Replay half of each trace in a heap kept in\n");
+    fprintf(stderr, "\t                  <file>, snapshot it, and finish the trace in\n");
+    fprintf(stderr, "\t                  a new process that resumes from <file>.\n");
+    fprintf(stderr, "\t--hot <n>x<bytes> Allocate <n> blocks of <bytes> each from mm.c\n");
+    fprintf(stderr, "\t                  and each --so, count the L1d sets they fall\n");
+    fprintf(stderr, "\t                  in, and time a loop that reads each of them.\n");
+    fprintf(stderr, "\t--hints           Replay each trace with its allocation hints\n");
+    fprintf(stderr, "\t                  ignored and then used; compare utilization\n");
+    fprintf(stderr, "\t                  and the lines and pages the hot blocks span.\n");
 }
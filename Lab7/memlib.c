@@ -8,8 +8,10 @@
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include "memlib.h"
 #include "config.h"
@@ -18,6 +20,70 @@
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static size_t mem_map_len;   /* bytes mmap'd for the heap (0 if malloc'd) */
+static int pages_mode = MEM_PAGES_MALLOC; /* set by mem_set_pages */
+static int prefault = 0;                  /* ditto */
+
+/* 
+ * The first page of a heap file, which is followed by the heap. The
+ * clean flag is set by mem_snapshot and cleared when the file is
+ * reopened, so that a process that dies between snapshots doesn't 
+ * leave a heap that looks resumable behind.
+ */
+#define MEM_FILE_MAGIC 0x6d656d31 /* "mem1" */
+#define MEM_FILE_HDR   4096       /* bytes before the heap */
+typedef struct {
+    unsigned int magic;           /* MEM_FILE_MAGIC */
+    unsigned int clean;           /* was the heap snapshotted since? */
+    unsigned long base;           /* address it was mapped at */
+    unsigned long max_heap;       /* MAX_HEAP when it was made */
+    unsigned long brk;            /* heap size at the snapshot */
+    char meta[MEM_META_BYTES];    /* the allocator's own state */
+} mem_file_t;
+static mem_file_t *mem_file = NULL; /* NULL if the heap isn't in a file */
+
+/* 
+ * map_heap - mmap len bytes for the heap, starting on a MEM_HUGE_ALIGN
+ *     boundary, and ask for huge pages or for no huge pages
+ */
+static char *map_heap(size_t len)
+{
+    char *p, *start;
+
+#ifdef MAP_HUGETLB
+    if (pages_mode == MEM_PAGES_HUGETLB) {
+	/* Hugetlb mappings come aligned to the huge page size */
+	p = mmap(NULL, len, PROT_READ|PROT_WRITE, 
+		 MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED)
+	    return p;
+	fprintf(stderr, "mem_init: MAP_HUGETLB failed (%s), "
+		"using transparent huge pages\n", strerror(errno));
+    }
+#endif
+
+    /* Map an extra MEM_HUGE_ALIGN bytes and trim to an aligned start */
+    p = mmap(NULL, len + MEM_HUGE_ALIGN, PROT_READ|PROT_WRITE, 
+	     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+	fprintf(stderr, "mem_init: mmap error\n");
+	exit(1);
+    }
+    start = (char *)(((unsigned long)p + MEM_HUGE_ALIGN - 1) & 
+		     ~(unsigned long)(MEM_HUGE_ALIGN - 1));
+    if (start > p)
+	munmap(p, start - p);
+    munmap(start + len, (p + MEM_HUGE_ALIGN) - start);
+
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+    if (madvise(start, len, (pages_mode == MEM_PAGES_SMALL) ? 
+		MADV_NOHUGEPAGE : MADV_HUGEPAGE) < 0 && 
+	pages_mode != MEM_PAGES_SMALL)
+	fprintf(stderr, "mem_init: MADV_HUGEPAGE failed (%s)\n", 
+		strerror(errno));
+#endif
+    return start;
+}
 
 /* 
  * mem_init - initialize the memory system model
@@ -25,10 +91,21 @@ static char *mem_max_addr;   /* largest legal heap address */
 void mem_init(void)
 {
     /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
-	exit(1);
+    if (pages_mode == MEM_PAGES_MALLOC) {
+	if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
+	    fprintf(stderr, "mem_init_vm: malloc error\n");
+	    exit(1);
+	}
+	mem_map_len = 0;
     }
+    else {
+	mem_map_len = (MAX_HEAP + MEM_HUGE_ALIGN - 1) & ~(MEM_HUGE_ALIGN - 1);
+	mem_start_brk = map_heap(mem_map_len);
+    }
+
+    /* Take the page faults now, rather than in the timed runs */
+    if (prefault)
+	memset(mem_start_brk, 0, MAX_HEAP);
 
     mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
@@ -39,7 +116,23 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    if (mem_file) {
+	munmap(mem_file, MEM_FILE_HDR + MAX_HEAP);
+	mem_file = NULL;
+    }
+    else if (mem_map_len)
+	munmap(mem_start_brk, mem_map_len);
+    else
+	free(mem_start_brk);
+}
+
+/*
+ * mem_set_pages - choose how the next mem_init backs the heap 
+ */
+void mem_set_pages(int mode, int prefault_arg)
+{
+    pages_mode = mode;
+    prefault = prefault_arg;
 }
 
 /*
@@ -99,3 +192,125 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_heap_pagesize - returns the largest page size that the heap is
+ *     on, and in *huge_bytes how much of it is on huge pages, as 
+ *     reported in /proc/self/smaps. Pages that haven't been touched
+ *     yet aren't on any page at all, so call it after a run.
+ */
+size_t mem_heap_pagesize(size_t *huge_bytes)
+{
+    FILE *fp;
+    char line[256];
+    unsigned long lo, hi, kb;
+    size_t pagesize = mem_pagesize();
+    int in_heap = 0;
+
+    *huge_bytes = 0;
+    if ((fp = fopen("/proc/self/smaps", "r")) == NULL)
+	return pagesize;
+    while (fgets(line, sizeof(line), fp)) {
+	if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2) {
+	    /* The first line of a mapping: is it (part of) the heap? */
+	    in_heap = (lo < (unsigned long)mem_max_addr && 
+		       hi > (unsigned long)mem_start_brk);
+	}
+	else if (in_heap && sscanf(line, "KernelPageSize: %lu kB", &kb) == 1) {
+	    if (kb * 1024 > pagesize) {
+		pagesize = kb * 1024;
+		*huge_bytes = MAX_HEAP;  /* hugetlb: all or nothing */
+	    }
+	}
+	else if (in_heap && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+	    if (kb > 0 && MEM_HUGE_ALIGN > pagesize) {
+		pagesize = MEM_HUGE_ALIGN;
+		*huge_bytes += kb * 1024;
+	    }
+	}
+    }
+    fclose(fp);
+    return pagesize;
+}
+
+/*
+ * mem_init_file - map the heap in the file at path, creating the file
+ *     if need be. Returns 1 if the file holds a clean snapshot to 
+ *     resume from, and 0 if the heap starts out empty.
+ */
+int mem_init_file(char *path)
+{
+    size_t len = MEM_FILE_HDR + MAX_HEAP;
+    void *want = (void *)HEAP_FILE_BASE;
+    int fd, flags = MAP_SHARED, resume;
+    struct stat st;
+
+    if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+	fprintf(stderr, "mem_init_file: could not open %s: %s\n", 
+		path, strerror(errno));
+	exit(1);
+    }
+    if (fstat(fd, &st) < 0 || 
+	((size_t)st.st_size < len && ftruncate(fd, len) < 0)) {
+	fprintf(stderr, "mem_init_file: could not size %s: %s\n", 
+		path, strerror(errno));
+	exit(1);
+    }
+
+#ifdef MAP_FIXED_NOREPLACE
+    flags |= MAP_FIXED_NOREPLACE;
+#endif
+    mem_file = mmap(want, len, PROT_READ|PROT_WRITE, flags, fd, 0);
+    close(fd);
+    if (mem_file != want) {
+	fprintf(stderr, "mem_init_file: could not map %s at %p\n", 
+		path, want);
+	exit(1);
+    }
+
+    resume = (mem_file->magic == MEM_FILE_MAGIC && mem_file->clean &&
+	      mem_file->base == (unsigned long)want &&
+	      mem_file->max_heap == MAX_HEAP);
+    if (!resume) {
+	if (mem_file->magic == MEM_FILE_MAGIC && !mem_file->clean)
+	    fprintf(stderr, "mem_init_file: %s wasn't snapshotted before "
+		    "its process ended, starting an empty heap\n", path);
+	memset(mem_file, 0, sizeof(mem_file_t));
+	mem_file->magic = MEM_FILE_MAGIC;
+	mem_file->base = (unsigned long)want;
+	mem_file->max_heap = MAX_HEAP;
+    }
+    mem_file->clean = 0;
+
+    mem_map_len = 0;
+    mem_start_brk = (char *)mem_file + MEM_FILE_HDR;
+    mem_max_addr = mem_start_brk + MAX_HEAP;
+    mem_brk = mem_start_brk + mem_file->brk;
+    return resume;
+}
+
+/*
+ * mem_meta - the allocator state area of a file-backed heap (or NULL)
+ */
+void *mem_meta(void)
+{
+    return mem_file ? mem_file->meta : NULL;
+}
+
+/*
+ * mem_snapshot - write a file-backed heap, its size, and the allocator
+ *     state area out to the file, and mark it resumable
+ */
+int mem_snapshot(void)
+{
+    if (mem_file == NULL)
+	return -1;
+    mem_file->brk = mem_brk - mem_start_brk;
+    if (msync(mem_file, MEM_FILE_HDR + (mem_brk - mem_start_brk), 
+	      MS_SYNC) < 0)
+	return -1;
+
+    /* Only claim to be clean once everything else is on disk */
+    mem_file->clean = 1;
+    return msync(mem_file, MEM_FILE_HDR, MS_SYNC);
+}
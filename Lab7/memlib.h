@@ -9,3 +9,41 @@ void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
 
+/* 
+ * How mem_init backs the simulated heap. The mmap'd kinds start the
+ * heap on a MEM_HUGE_ALIGN boundary, so that it can sit on huge pages.
+ */
+#define MEM_PAGES_MALLOC  0  /* malloc, as in the original lab (default) */
+#define MEM_PAGES_SMALL   1  /* mmap, base pages only (MADV_NOHUGEPAGE) */
+#define MEM_PAGES_HUGE    2  /* mmap, transparent huge pages (MADV_HUGEPAGE) */
+#define MEM_PAGES_HUGETLB 3  /* mmap with MAP_HUGETLB, else like HUGE */
+#define MEM_HUGE_ALIGN (1 << 21)
+
+/* mem_set_pages - Choose the heap's backing for the next mem_init, and
+ *     whether mem_init should fault in the whole heap up front */
+void mem_set_pages(int mode, int prefault);
+
+/* mem_heap_pagesize - The largest page size that the heap is actually
+ *     on (from /proc/self/smaps), and in *huge_bytes how much of it is
+ *     on pages larger than mem_pagesize() */
+size_t mem_heap_pagesize(size_t *huge_bytes);
+
+/*
+ * A heap can also live in a file, mapped at HEAP_FILE_BASE, together
+ * with MEM_META_BYTES of allocator state. After mem_snapshot, a later
+ * process can map the same file and carry on with the same blocks.
+ */
+#define MEM_META_BYTES 1024
+
+/* mem_init_file - Instead of mem_init, map the heap in the file at path.
+ *     Returns 1 if it holds a snapshot to resume from, else 0 (the 
+ *     heap starts out empty) */
+int mem_init_file(char *path);
+
+/* mem_meta - The allocator state area saved with a file-backed heap,
+ *     or NULL if the heap isn't file-backed */
+void *mem_meta(void);
+
+/* mem_snapshot - Write the heap and its state area out to the file.
+ *     Returns 0 on success, -1 if the heap isn't file-backed */
+int mem_snapshot(void);
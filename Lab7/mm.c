@@ -32,12 +32,61 @@
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 
 /* My additional Macros*/
+
+/*
+ * The tunable constants can be overridden with -D, or all at once by
+ * building with -DMM_TUNED to pick up the mm_tuned.h that mmtune.pl
+ * writes. SEGLIST_LEVEL also sets the class boundary above which all
+ * sizes share the last list (2^(SEGLIST_LEVEL-1) bytes).
+ */
+#ifdef MM_TUNED
+#include "mm_tuned.h"
+#endif
+#ifndef SEGLIST_LEVEL
 #define SEGLIST_LEVEL 20
+#endif
 #define WSIZE 4
 #define DSIZE 8
+#ifndef CHUNKSIZE
 #define CHUNKSIZE (1 << 11)
+#endif
+#ifndef REALLOCCHUNK
 #define REALLOCCHUNK (3 << 13)
+#endif
+#ifndef LARGEBLOCK
 #define LARGEBLOCK (3 << 5)
+#endif
+
+/*
+ * Quick lists hold freed blocks of the QUICK_LISTS smallest sizes (16, 24,
+ * ... bytes) as they are, without coalescing, for the next mm_malloc of the
+ * same size to take back. A list holds up to QUICK_LIMIT blocks; the next
+ * free into a full list coalesces them all, as does an mm_malloc that would
+ * otherwise have to extend the heap. QUICK_LIMIT 0 turns them off.
+ */
+#ifndef QUICK_LISTS
+#define QUICK_LISTS 8
+#endif
+#ifndef QUICK_LIMIT
+#define QUICK_LIMIT 32
+#endif
+
+/*
+ * Hints from mm_malloc_hinted (see mm.h). Long-lived and hot blocks are put by
+ * find_near in whichever free block, among the first HINT_SCAN that fit without
+ * being more than twice as big as needed, is nearest to a target: the bottom of
+ * the heap for long-lived blocks, which packs them together below the churn of
+ * the short-lived ones, and the last hot block for hot ones, which keeps the hot
+ * data on few pages. This is a bounded search, not a first fit from the bottom,
+ * so a long-lived block can land above the lowest free block that would hold
+ * it. Blocks bigger than LARGEBLOCK normally go at the high end of the free
+ * block they are split from; a long-lived one, or one that will be grown, goes
+ * at the low end instead, so that the rest is there to grow into. Other hints
+ * don't change placement. HINT_SCAN 0 ignores all hints.
+ */
+#ifndef HINT_SCAN
+#define HINT_SCAN 64
+#endif
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y)) 
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
@@ -46,6 +95,7 @@
 #define SET(p, val)  (*(unsigned int *)(p) = (unsigned int) val)
 #define GET_SIZE(p)  (GET(p) & ~0x7)                                     // all sizes are divided by 8
 #define GET_ALLOC(p) (GET(p) & 0x1)                                      // get allocation tag
+#define GET_QUICK(p) (GET(p) & 0x2)                                      // get quick list tag (only with allocation tag)
 #define HEAD(ptr)       ((char *)(ptr) - WSIZE)                          // get header of the block
 #define FOOT(ptr)       ((char *)(ptr) + GET_SIZE(HEAD(ptr)) - DSIZE)    // get footer of the block
 #define PPREV(ptr)  ((char *)(ptr) - GET_SIZE(((char *)(ptr) - DSIZE)))  //get the previous block in the heap
@@ -54,13 +104,86 @@
 #define NEXT_PTR(ptr) ((char *)(ptr) + WSIZE)                            //get address of the pointer of previous block in the seglist
 #define PREV(ptr) (*(char **)(ptr))                                      //get address of the previous block in the seglist
 #define NEXT(ptr) (*(char **)(NEXT_PTR(ptr)))                            //get address of the next block in the seglist
+#define QUICK_INDEX(size) (((size) - 2 * DSIZE) / ALIGNMENT)                // quick list of a block size
+#define SIZE_CLASS(size) MIN(SEGLIST_LEVEL - 1, 31 - __builtin_clz((unsigned int)(size) | 1)) // seglist index of a size
 
+/*
+ * Static tracepoints (USDT probes, provider "mm") for looking at a running
+ * allocator with perf, bpftrace or SystemTap without rebuilding it:
+ *
+ *   malloc_entry(size)                    malloc_return(size, ptr, class, walk)
+ *   free_entry(ptr, size, class)          free_return(ptr, walk)
+ *   realloc_entry(ptr, size)              realloc_return(size, ptr, class, walk)
+ *   extend_heap(ptr, size)                coalesce(ptr, size)
+ *   split(ptr, size, remainder)           quick_flush(class, count)
+ *
+ * class is the seglist index of the block size (for quick_flush, of the
+ * size of the blocks on the quick list) and walk the number of list nodes
+ * the call stepped over. A probe nobody is attached to is a single nop.
+ * Each probe has an SDT semaphore, which the tracer sets while it is
+ * attached (perf needs Linux 4.20 or later for that), and walk is only
+ * counted while one of the *_return probes is on; otherwise it is 0.
+ * The probes are left out altogether if <sys/sdt.h> (systemtap-sdt-dev)
+ * isn't installed, or with -DMM_NO_PROBES. mmprobes.pl turns a recording
+ * into a latency report by size class.
+ */
+#if !defined(MM_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define MM_PROBES
+#endif
+#endif
+
+#ifdef MM_PROBES
+#define SEMAPHORE(name) unsigned short mm_##name##_semaphore __attribute__((unused, section(".probes")))
+SEMAPHORE(malloc_entry);
+SEMAPHORE(malloc_return);
+SEMAPHORE(free_entry);
+SEMAPHORE(free_return);
+SEMAPHORE(realloc_entry);
+SEMAPHORE(realloc_return);
+SEMAPHORE(extend_heap);
+SEMAPHORE(coalesce);
+SEMAPHORE(split);
+SEMAPHORE(quick_flush);
+static unsigned int walk;    // list nodes stepped over in the current call
+static int walk_on;          // is anyone looking at walk?
+#define WALK_RESET() (walk = 0, walk_on = __builtin_expect(mm_malloc_return_semaphore | mm_free_return_semaphore | mm_realloc_return_semaphore, 0))
+#define WALK_STEP()  (walk_on ? walk++ : 0)
+#define PROBE1(name, a)          DTRACE_PROBE1(mm, name, a)
+#define PROBE2(name, a, b)       DTRACE_PROBE2(mm, name, a, b)
+#define PROBE3(name, a, b, c)    DTRACE_PROBE3(mm, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(mm, name, a, b, c, d)
+#else
+#define WALK_RESET()
+#define WALK_STEP()
+#define PROBE1(name, a)
+#define PROBE2(name, a, b)
+#define PROBE3(name, a, b, c)
+#define PROBE4(name, a, b, c, d)
+#endif
 
 
 /* Declare of global variable (segregation list)*/
 
 void* seglist[SEGLIST_LEVEL];
 
+/* The quick lists, linked through the first word of the payload, and their lengths */
+void* quick[QUICK_LISTS];
+int quick_count[QUICK_LISTS];
+
+/* The hot block that mm_malloc_hinted handed out last */
+void* hot_last;
+
+/* What mm_snapshot saves in the heap file, beside the heap itself. */
+#define SNAPSHOT_MAGIC 0x6d6d7331
+typedef struct {
+    unsigned int magic;           // SNAPSHOT_MAGIC
+    unsigned int levels;          // SEGLIST_LEVEL of the saving mm.c
+    void *seglist[SEGLIST_LEVEL]; // the seglist heads
+} snapshot_t;
+
 /* Declare of helper functions */
 
 static void *extend_heap(size_t size);
@@ -68,7 +191,11 @@ static void *coalesce(void *ptr, int realloc);
 static void seg_insert(void *ptr, size_t size);
 static void seg_delete(void *ptr);
 static void *find_block(size_t size);
-static void *allocate_block(void *ptr, void *oldptr, size_t newsize, size_t oldsize, int realloc);
+static void *find_near(size_t newsize, void *target);
+static void *allocate_block(void *ptr, void *oldptr, size_t newsize, size_t oldsize, int realloc, int high);
+static void free_block(void *ptr);
+static void quick_flush(int index);
+static int quick_flush_all(void);
 static size_t new_size(size_t size);
 static int is_contain(void *address); // Check all free blocks are contained in the seglist
 static int check_seglist(); // Check whether all blocks in the seglist are free block
@@ -85,6 +212,7 @@ static void *extend_heap(size_t size)
     ptr = mem_sbrk(newsize);
     if(ptr == (void *)-1)
         return NULL;
+    PROBE2(extend_heap, ptr, newsize);
 
     SET(HEAD(ptr), PACK(newsize, 0));  
     SET(FOOT(ptr), PACK(newsize, 0));   
@@ -113,6 +241,7 @@ static void seg_insert(void *ptr, size_t size)
     {
         insert_ptr = search_ptr;
         search_ptr = NEXT(search_ptr);
+        WALK_STEP();
     }
 
     if(search_ptr != NULL)
@@ -242,6 +371,7 @@ static void *coalesce(void *ptr, int realloc)
         SET(FOOT(PNEXT(ptr)), PACK(size, 0));
         ptr = PPREV(ptr);
     }
+    PROBE2(coalesce, ptr, size);
     /* Insert the coalesce block to the seglist */
     if(!realloc)
         seg_insert(ptr, size);
@@ -265,6 +395,7 @@ static void *find_block(size_t newsize)
             while((ptr != NULL) && (newsize > GET_SIZE(HEAD(ptr))))
             {
                 ptr = NEXT(ptr);
+                WALK_STEP();
             }
             if(ptr != NULL)
                 break;
@@ -275,8 +406,39 @@ static void *find_block(size_t newsize)
     return ptr;
 }
 
-/* Allocate block to the address which find using find_block. */
-static void *allocate_block(void *ptr, void *oldptr, size_t newsize, size_t oldsize, int realloc)
+/* Find a free block that can hold newsize and is at most about twice as big,
+ * among the first HINT_SCAN of them, that is nearest to target. Fall back to
+ * find_block if there is none. */
+static void *find_near(size_t newsize, void *target)
+{
+    void *ptr;
+    void *best = NULL;
+    size_t limit = 2 * newsize + 2 * DSIZE;
+    unsigned long dist, best_dist = 0;
+    int list_index = SIZE_CLASS(newsize);
+    int seen = 0;
+
+    for(; list_index <= SIZE_CLASS(limit) && seen < HINT_SCAN; list_index++)
+    {
+        for(ptr = seglist[list_index]; ptr != NULL && seen < HINT_SCAN; ptr = NEXT(ptr))
+        {
+            WALK_STEP();
+            if(GET_SIZE(HEAD(ptr)) < newsize || GET_SIZE(HEAD(ptr)) > limit)
+                continue;
+            seen++;
+            dist = ((char *)ptr > (char *)target) ? (char *)ptr - (char *)target : (char *)target - (char *)ptr;
+            if(best == NULL || dist < best_dist)
+            {
+                best = ptr;
+                best_dist = dist;
+            }
+        }
+    }
+    return (best != NULL) ? best : find_block(newsize);
+}
+
+/* Allocate block to the address which find using find_block, at the high end of it if high is set. */
+static void *allocate_block(void *ptr, void *oldptr, size_t newsize, size_t oldsize, int realloc, int high)
 {
     size_t ptr_size = GET_SIZE(HEAD(ptr));
     size_t remainder = ptr_size - newsize;
@@ -290,7 +452,7 @@ static void *allocate_block(void *ptr, void *oldptr, size_t newsize, size_t olds
         SET(HEAD(ptr), PACK(ptr_size, 1));
         SET(FOOT(ptr), PACK(ptr_size, 1)); 
     }
-    else if(newsize > LARGEBLOCK)
+    else if(high)
     {
         if(oldptr != NULL)
             memmove(ptr+remainder, oldptr, MIN(newsize - DSIZE, oldsize - DSIZE));
@@ -298,6 +460,7 @@ static void *allocate_block(void *ptr, void *oldptr, size_t newsize, size_t olds
         SET(FOOT(ptr), PACK(remainder, 0)); 
         SET(HEAD(PNEXT(ptr)), PACK(newsize, 1)); 
         SET(FOOT(PNEXT(ptr)), PACK(newsize, 1)); 
+        PROBE3(split, PNEXT(ptr), newsize, remainder);
         seg_insert(ptr, remainder);
         return PNEXT(ptr);
     }
@@ -309,11 +472,57 @@ static void *allocate_block(void *ptr, void *oldptr, size_t newsize, size_t olds
         SET(FOOT(ptr), PACK(newsize, 1)); 
         SET(HEAD(PNEXT(ptr)), PACK(remainder, 0)); 
         SET(FOOT(PNEXT(ptr)), PACK(remainder, 0)); 
+        PROBE3(split, ptr, newsize, remainder);
         seg_insert(PNEXT(ptr), remainder);
     }
     return ptr;
 }
 
+/* Free the block. mm_realloc uses this rather than mm_free, so that its
+ * probes don't fire inside a realloc's. */
+static void free_block(void *ptr)
+{
+    size_t size = GET_SIZE(HEAD(ptr));
+    SET(HEAD(ptr), PACK(size, 0));
+    SET(FOOT(ptr), PACK(size, 0));
+    seg_insert(ptr, size);
+    coalesce(ptr, 0);
+}
+
+/* Coalesce all the blocks in a quick list and put them in the seglist. */
+static void quick_flush(int index)
+{
+    void *ptr = quick[index];
+    void *next;
+
+    PROBE2(quick_flush, SIZE_CLASS(index * ALIGNMENT + 2 * DSIZE), quick_count[index]);
+    while(ptr != NULL)
+    {
+        next = PREV(ptr);
+        free_block(ptr);
+        ptr = next;
+    }
+    quick[index] = NULL;
+    quick_count[index] = 0;
+}
+
+/* Flush every quick list. Return whether there was anything to flush. */
+static int quick_flush_all(void)
+{
+    int index;
+    int flushed = 0;
+
+    for(index = 0; index < QUICK_LISTS; index++)
+    {
+        if(quick[index] != NULL)
+        {
+            quick_flush(index);
+            flushed = 1;
+        }
+    }
+    return flushed;
+}
+
 /* The function allign the block. */
 static size_t new_size(size_t size)
 {
@@ -336,6 +545,11 @@ int mm_init(void)
     for (list = 0; list < SEGLIST_LEVEL; list++) {
         seglist[list] = NULL;
     }
+    for (list = 0; list < QUICK_LISTS; list++) {
+        quick[list] = NULL;
+        quick_count[list] = 0;
+    }
+    hot_last = NULL;
     
     // Allocate memory for the initial empty heap 
     heap = mem_sbrk(4 * WSIZE);
@@ -356,9 +570,44 @@ int mm_init(void)
  */
 void *mm_malloc(size_t size)
 {
-    size_t newsize = new_size(size);
-    void *ptr = find_block(newsize);
+    return mm_malloc_hinted(size, 0);
+}
 
+/*
+ * mm_malloc_hinted - Allocate like mm_malloc, but put hot blocks near the last
+ * hot block and long-lived ones as low in the heap as a short search finds,
+ * and split a large block that will be grown from the low end of a free block.
+ */
+void *mm_malloc_hinted(size_t size, int flags)
+{
+    size_t newsize;
+    void *ptr;
+
+    PROBE1(malloc_entry, size);
+    WALK_RESET();
+    newsize = new_size(size);
+    if(QUICK_LIMIT > 0 && QUICK_INDEX(newsize) < QUICK_LISTS && quick[QUICK_INDEX(newsize)] != NULL)
+    {
+        /* Take the block that was freed last back from the quick list */
+        ptr = quick[QUICK_INDEX(newsize)];
+        quick[QUICK_INDEX(newsize)] = PREV(ptr);
+        quick_count[QUICK_INDEX(newsize)]--;
+        SET(HEAD(ptr), PACK(newsize, 1));
+        SET(FOOT(ptr), PACK(newsize, 1));
+        PROBE4(malloc_return, size, ptr, SIZE_CLASS(newsize), walk);
+        return ptr;
+    }
+    if(HINT_SCAN == 0)
+        flags = 0;
+    if(flags & MM_HINT_HOT)
+        ptr = find_near(newsize, hot_last);
+    else if(flags & MM_HINT_LONG)
+        ptr = find_near(newsize, mem_heap_lo());
+    else
+        ptr = find_block(newsize);
+
+    if(ptr == NULL && quick_flush_all())
+        ptr = find_block(newsize);
     if(ptr == NULL)
     {
         ptr = extend_heap(MAX(newsize,CHUNKSIZE));
@@ -366,19 +615,37 @@ void *mm_malloc(size_t size)
             return NULL;
     }
 
-    return allocate_block(ptr, NULL, newsize,0, 0);
+    ptr = allocate_block(ptr, NULL, newsize,0, 0, newsize > LARGEBLOCK && !(flags & (MM_HINT_LONG | MM_HINT_REALLOC)));
+    if(flags & MM_HINT_HOT)
+        hot_last = ptr;
+    PROBE4(malloc_return, size, ptr, SIZE_CLASS(newsize), walk);
+    return ptr;
 }
 
 /*
- * mm_free - Set the block to free and coalese with neighborhood free blocks.
+ * mm_free - Put a small block on its quick list, and otherwise set the block
+ * to free and coalese with neighborhood free blocks.
  */
 void mm_free(void *ptr)
 {
     size_t size = GET_SIZE(HEAD(ptr));
-    SET(HEAD(ptr), PACK(size, 0));
-    SET(FOOT(ptr), PACK(size, 0));
-    seg_insert(ptr, size);
-    coalesce(ptr, 0);
+
+    PROBE3(free_entry, ptr, size, SIZE_CLASS(size));
+    WALK_RESET();
+    if(QUICK_LIMIT > 0 && QUICK_INDEX(size) < QUICK_LISTS)
+    {
+        /* The block stays allocated as far as its neighbors can tell */
+        if(quick_count[QUICK_INDEX(size)] >= QUICK_LIMIT)
+            quick_flush(QUICK_INDEX(size));
+        SET(HEAD(ptr), PACK(size, 3));
+        SET(FOOT(ptr), PACK(size, 3));
+        SET(PREV_PTR(ptr), quick[QUICK_INDEX(size)]);
+        quick[QUICK_INDEX(size)] = ptr;
+        quick_count[QUICK_INDEX(size)]++;
+    }
+    else
+        free_block(ptr);
+    PROBE2(free_return, ptr, walk);
     return;
 }
 
@@ -393,13 +660,27 @@ void *mm_realloc(void *ptr, size_t size)
     void *newptr;
     size_t newsize = new_size(size);
     size_t oldsize = GET_SIZE(HEAD(oldptr));
+    PROBE2(realloc_entry, oldptr, size);
+    WALK_RESET();
+    /* Give neighbors on quick lists back to the seglist, so that the block
+     * can grow into them */
+    if(GET_QUICK(HEAD(PNEXT(oldptr))))
+        quick_flush(QUICK_INDEX(GET_SIZE(HEAD(PNEXT(oldptr)))));
+    if(GET_QUICK(HEAD(PPREV(oldptr))))
+        quick_flush(QUICK_INDEX(GET_SIZE(HEAD(PPREV(oldptr)))));
     SET(HEAD(oldptr), PACK(oldsize, 1));
     SET(FOOT(oldptr), PACK(oldsize, 1));
     tempptr = coalesce(oldptr, 1);
+    /* Keep the merged block allocated until the data is copied out, so
+     * that extend_heap can't coalesce the new space into it */
+    SET(HEAD(tempptr), PACK(GET_SIZE(HEAD(tempptr)), 1));
+    SET(FOOT(tempptr), PACK(GET_SIZE(HEAD(tempptr)), 1));
     newptr = find_block(newsize);
    
     if(newsize > GET_SIZE(HEAD(tempptr)) || (newptr != NULL && GET_SIZE(HEAD(newptr)) < GET_SIZE(HEAD(tempptr))))
     {
+        if (newptr == NULL && quick_flush_all())
+            newptr = find_block(newsize);
         if (newptr == NULL)
         {
             newptr = extend_heap(MAX(newsize, REALLOCCHUNK));
@@ -407,17 +688,75 @@ void *mm_realloc(void *ptr, size_t size)
                 return NULL;
         }
         
-        newptr = allocate_block(newptr, oldptr, newsize, oldsize, 0);
-        seg_insert(tempptr, GET_SIZE(HEAD(tempptr)));
+        newptr = allocate_block(newptr, oldptr, newsize, oldsize, 0, newsize > LARGEBLOCK);
+        free_block(tempptr);
     }
     else
     {
-        newptr = allocate_block(tempptr, oldptr, newsize, oldsize, 1);
+        newptr = allocate_block(tempptr, oldptr, newsize, oldsize, 1, newsize > LARGEBLOCK);
     }
     
+    PROBE4(realloc_return, size, newptr, SIZE_CLASS(newsize), walk);
     return newptr;
 }
 
+/*
+ * mm_snapshot - Empty the quick lists, save the seglist heads in the heap file
+ * and write the heap out. The rest of the allocator's state (the prologue, the
+ * epilogue and the blocks between them) is already in the heap.
+ */
+int mm_snapshot(void)
+{
+    snapshot_t *snap = mem_meta();
+
+    if(snap == NULL || sizeof(snapshot_t) > MEM_META_BYTES)
+        return -1;
+    quick_flush_all();
+    snap->magic = SNAPSHOT_MAGIC;
+    snap->levels = SEGLIST_LEVEL;
+    memcpy(snap->seglist, seglist, sizeof(seglist));
+    return mem_snapshot();
+}
+
+/*
+ * mm_restore - Resume from a snapshot. Check that it was taken by an mm.c with
+ * the same seglist layout and that the prologue and epilogue are where they
+ * should be, then take the seglist heads from it.
+ */
+int mm_restore(void)
+{
+    snapshot_t *snap = mem_meta();
+    char *heap = mem_heap_lo();
+
+    if(snap == NULL || snap->magic != SNAPSHOT_MAGIC || snap->levels != SEGLIST_LEVEL)
+        return -1;
+    if(mem_heapsize() < 4 * WSIZE)
+        return -1;
+    if(GET(heap + WSIZE) != PACK(DSIZE, 1) || GET(heap + 2 * WSIZE) != PACK(DSIZE, 1))
+        return -1;
+    if(GET((char *)mem_heap_hi() + 1 - WSIZE) != PACK(0, 1))
+        return -1;
+
+    memcpy(seglist, snap->seglist, sizeof(seglist));
+    memset(quick, 0, sizeof(quick));
+    memset(quick_count, 0, sizeof(quick_count));
+    hot_last = NULL;
+    return 0;
+}
+
+/*
+ * mm_heapwalk - Visit every block between the prologue and the epilogue.
+ */
+void mm_heapwalk(mm_visit_funct visit, void *arg)
+{
+    void *cur_block = mem_heap_lo() + DSIZE;
+    while(GET_SIZE(HEAD(cur_block)) > 0)
+    {
+        visit(HEAD(cur_block), GET_SIZE(HEAD(cur_block)), GET_ALLOC(HEAD(cur_block)) && !GET_QUICK(HEAD(cur_block)), arg);
+        cur_block = PNEXT(cur_block);
+    }
+}
+
 /**
  * mm_check check consistency of the heap by follwing tests.
  * 1.check size header and footer of all blocks are correctly
@@ -5,6 +5,42 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 
+/*
+ * mm_malloc_hinted - Like mm_malloc, but with hints about how the block
+ *     will be used, which the allocator may use to place it better or
+ *     ignore. flags is any combination of the MM_HINT_* bits below;
+ *     mm_malloc_hinted(size, 0) is mm_malloc(size). In a trace, an
+ *     alloc request carries them as h=<letters>, e.g. "a 7 64 h=sh".
+ */
+#define MM_HINT_SHORT   0x01  /* s: will be freed again soon */
+#define MM_HINT_LONG    0x02  /* l: will live for most of the run */
+#define MM_HINT_HOT     0x04  /* h: will be read and written often */
+#define MM_HINT_COLD    0x08  /* c: will rarely be touched */
+#define MM_HINT_REALLOC 0x10  /* r: will be grown with mm_realloc */
+extern void *mm_malloc_hinted(size_t size, int flags);
+
+/* 
+ * mm_heapwalk - Call visit once for every block in the heap, in address
+ *     order, with the block's first byte (including any header), its
+ *     total size, and whether it is allocated. Used by the driver to
+ *     profile fragmentation.
+ */
+typedef void (*mm_visit_funct)(void *block, size_t size, int alloc, void *arg);
+extern void mm_heapwalk(mm_visit_funct visit, void *arg);
+
+/*
+ * mm_snapshot - Save the allocator's state (and, with it, the heap) 
+ *     in the heap's file, if memlib put the heap in one with
+ *     mem_init_file. Returns 0 on success, -1 on error.
+ *
+ * mm_restore - Instead of mm_init, pick up from the snapshot in the 
+ *     heap file that mem_init_file found. Every block that was
+ *     allocated at the snapshot is still allocated, at the same
+ *     address. Returns 0 on success, -1 if there is no usable snapshot.
+ */
+extern int mm_snapshot(void);
+extern int mm_restore(void);
+
 
 /* 
  * Students work in teams of one or two.  Teams enter their team name, 
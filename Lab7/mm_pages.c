@@ -0,0 +1,547 @@
+/*
+ * mm_pages.c
+ *
+ * An alternative to mm.c that shards the free lists by heap page, after
+ * mimalloc. The heap is cut into PAGE_BYTES pages, handed out in spans of
+ * one or more pages, each starting with a page_t header:
+ *
+ *      small page:  | header | block | block | ... | block | not carved yet |
+ *      large block: | header | payload ...................................... |
+ *      free span:   | header | unused ....................................... |
+ *
+ * A small page (a span, really, of as many pages as it takes to hold
+ * PAGE_BLOCKS blocks) serves a single size class. Its blocks have no
+ * headers; the page map, outside the heap, says which span each page is in,
+ * and the span says how big its blocks are. Each page keeps two free lists
+ * of its own: mm_malloc
+ * pops from free, mm_free pushes to deferred, and deferred becomes the new
+ * free list when free runs dry. Blocks that were never handed out are carved
+ * off the end in address order.
+ *
+ * Every class has a queue of the pages that may have a block to give, and
+ * mm_malloc takes from the one at the front until it is full, so blocks that
+ * are allocated one after another sit next to each other, and a list walk
+ * never leaves the page. A page that empties is given back as a free span,
+ * which any class, or a large block, can reuse.
+ *
+ * Requests over SMALL_MAX bytes get a span of their own. Free spans are
+ * merged with the free spans after them as they are looked at, and a span at
+ * the end of the heap grows in place.
+ *
+ * Unless COLOR_LINE is 0, blocks are colored: the room left over at the end
+ * of a span is used to start each new page of a class (and each large block)
+ * COLOR_LINE bytes further in than the last, cycling, so that the nth block
+ * of every page doesn't land in the same cache set. Blocks whose size is a
+ * multiple of COLOR_LINE are also lined up with cache lines, if the room
+ * allows.
+ *
+ * Build it with "make mm_pages.so" and compare it with mm.c with
+ * "mdriver --so ./mm_pages.so".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "config.h"
+
+/*
+ * The page size, the largest small block and the fewest blocks a small page
+ * holds can be set with -D. Small sizes go up by GRAIN to 8 * GRAIN, then in
+ * four steps per doubling.
+ */
+#ifndef PAGE_BYTES
+#define PAGE_BYTES (1 << 12)
+#endif
+#ifndef SMALL_MAX
+#define SMALL_MAX (1 << 12)
+#endif
+#ifndef PAGE_BLOCKS
+#define PAGE_BLOCKS 4
+#endif
+#ifndef COLOR_LINE
+#define COLOR_LINE 64
+#endif
+#define GRAIN 16
+#define CLASSES 64     // room for the classes up to SMALL_MAX = 2^20
+
+#define KIND_FREE  0
+#define KIND_SMALL 1
+#define KIND_LARGE 2
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+#define ROUNDUP(n, m) ((((n) + (m) - 1) / (m)) * (m))
+#define HDR_BYTES ROUNDUP(sizeof(page_t), GRAIN)                  // page header, padded
+#define PAGES(bytes) (ROUNDUP(bytes, PAGE_BYTES) / PAGE_BYTES)
+#define LINE_PAD(p) ((COLOR_LINE - (unsigned long)(p) % COLOR_LINE) % COLOR_LINE) // bytes to the next line
+#define SPAN_END(s) ((char *)(s) + (size_t)(s)->npages * PAGE_BYTES)
+#define NEXT_FREE(bp) (*(void **)(bp))                             // link in a page's free lists
+
+typedef struct page {
+    unsigned int kind;     // KIND_FREE, KIND_SMALL or KIND_LARGE
+    unsigned int npages;   // pages in the span
+    unsigned int bsize;    // small: block size; large: payload size asked for
+    unsigned int cls;      // small: size class
+    unsigned int capacity; // small: blocks the page holds
+    unsigned int carved;   // small: blocks carved off so far
+    unsigned int used;     // small: blocks allocated
+    unsigned int queued;   // small: whether the page is in its class's queue
+    unsigned int offset;   // where the first block or the payload starts
+    void *free;            // small: free list for mm_malloc
+    void *deferred;        // small: free list for mm_free
+    struct page *prev;     // in the class's queue, or the free spans
+    struct page *next;
+} page_t;
+
+/* The allocator's state, which mm_snapshot saves beside the heap */
+#define PAGES_MAGIC 0x6d6d7032
+typedef struct {
+    unsigned int magic;       // PAGES_MAGIC, in a snapshot
+    char *first;              // start of the first span
+    page_t *last;             // the span that ends at the brk, or NULL
+    page_t *free_spans;       // free spans, last freed first
+    page_t *queue[CLASSES];   // per class, the pages that may have a free block
+    unsigned int color[CLASSES + 1]; // per class, and for large blocks, the next color
+} state_t;
+
+static state_t st;
+
+/* Block size of each class, and the class for each multiple of GRAIN */
+static unsigned int class_size[CLASSES];
+static unsigned char class_of[SMALL_MAX / GRAIN + 1];
+
+/* The span that each page of a small page is in, and the first page of a
+ * large block's */
+static page_t *page_map[MAX_HEAP / PAGE_BYTES];
+
+/* Declare of helper functions */
+
+static void init_classes(void);
+static void list_push(page_t **head, page_t *p);
+static void list_remove(page_t **head, page_t *p);
+static page_t *page_of(void *bp);
+static void span_merge(page_t *s);
+static void span_split(page_t *s, unsigned int npages);
+static page_t *span_alloc(unsigned int npages);
+static void span_free(page_t *s);
+static void span_color(page_t *s, size_t used, size_t bsize, unsigned int *color);
+static page_t *page_new(unsigned int cls);
+static void *page_take(page_t *p);
+
+/* Fill in class_size and class_of. */
+static void init_classes(void)
+{
+    unsigned int cls = 0;
+    unsigned int size = GRAIN;
+    unsigned int i;
+
+    for(cls = 0; size < SMALL_MAX; cls++)
+    {
+        class_size[cls] = size;
+        size += (size < 8 * GRAIN) ? GRAIN : (1 << (31 - __builtin_clz(size))) / 4;
+    }
+    class_size[cls] = SMALL_MAX;
+
+    cls = 0;
+    for(i = 0; i <= SMALL_MAX / GRAIN; i++)
+    {
+        while(class_size[cls] < i * GRAIN)
+            cls++;
+        class_of[i] = cls;
+    }
+}
+
+/* Push a page at the front of a doubly linked list. */
+static void list_push(page_t **head, page_t *p)
+{
+    p->prev = NULL;
+    p->next = *head;
+    if(*head != NULL)
+        (*head)->prev = p;
+    *head = p;
+}
+
+/* Take a page out of a doubly linked list. */
+static void list_remove(page_t **head, page_t *p)
+{
+    if(p->prev != NULL)
+        p->prev->next = p->next;
+    else
+        *head = p->next;
+    if(p->next != NULL)
+        p->next->prev = p->prev;
+}
+
+/* The span a payload is in. */
+static page_t *page_of(void *bp)
+{
+    return page_map[((char *)bp - st.first) / PAGE_BYTES];
+}
+
+/* Merge the free spans that follow a span into it. */
+static void span_merge(page_t *s)
+{
+    page_t *n;
+
+    while(s != st.last)
+    {
+        n = (page_t *)SPAN_END(s);
+        if(n->kind != KIND_FREE)
+            break;
+        list_remove(&st.free_spans, n);
+        s->npages += n->npages;
+        if(n == st.last)
+            st.last = s;
+    }
+}
+
+/* Cut a span down to npages, and free the rest. */
+static void span_split(page_t *s, unsigned int npages)
+{
+    page_t *r;
+
+    if(s->npages <= npages)
+        return;
+    r = (page_t *)((char *)s + (size_t)npages * PAGE_BYTES);
+    r->kind = KIND_FREE;
+    r->npages = s->npages - npages;
+    list_push(&st.free_spans, r);
+    if(s == st.last)
+        st.last = r;
+    s->npages = npages;
+}
+
+/* Find a span of npages, from the free spans if one is big enough, else by
+ * growing the heap. Return NULL if the heap is out of room. */
+static page_t *span_alloc(unsigned int npages)
+{
+    page_t *s;
+
+    for(s = st.free_spans; s != NULL; s = s->next)
+    {
+        span_merge(s);
+        if(s->npages >= npages)
+        {
+            list_remove(&st.free_spans, s);
+            span_split(s, npages);
+            return s;
+        }
+    }
+
+    /* A free span at the end of the heap only needs topping up */
+    if(st.last != NULL && st.last->kind == KIND_FREE)
+    {
+        if(mem_sbrk((npages - st.last->npages) * PAGE_BYTES) == (void *)-1)
+            return NULL;
+        s = st.last;
+        list_remove(&st.free_spans, s);
+        s->npages = npages;
+        return s;
+    }
+
+    s = mem_sbrk(npages * PAGE_BYTES);
+    if(s == (void *)-1)
+        return NULL;
+    s->npages = npages;
+    st.last = s;
+    return s;
+}
+
+/* Give a span back. */
+static void span_free(page_t *s)
+{
+    s->kind = KIND_FREE;
+    span_merge(s);
+    list_push(&st.free_spans, s);
+}
+
+/* Set where in a span its blocks (of bsize bytes, or 0 for a large block)
+ * start: just past the header, then at the next cache line if bsize is whole
+ * lines, then at the next of the colors that the room left over after the
+ * used bytes of blocks allows. A large block's payload has to stay in the
+ * first page, the only one of its pages in the page map. */
+static void span_color(page_t *s, size_t used, size_t bsize, unsigned int *color)
+{
+    s->offset = HDR_BYTES;
+#if COLOR_LINE > 0
+    size_t room = MIN((size_t)s->npages * PAGE_BYTES - HDR_BYTES - used,
+                      PAGE_BYTES - HDR_BYTES - COLOR_LINE);
+
+    if(bsize % COLOR_LINE == 0 && LINE_PAD((char *)s + HDR_BYTES) <= room)
+    {
+        room -= LINE_PAD((char *)s + HDR_BYTES);
+        s->offset += LINE_PAD((char *)s + HDR_BYTES);
+    }
+    s->offset += (*color)++ % (room / COLOR_LINE + 1) * COLOR_LINE;
+#endif
+}
+
+/* Start a new page for a class, at the front of the class's queue. */
+static page_t *page_new(unsigned int cls)
+{
+    page_t *p = span_alloc(PAGES(HDR_BYTES + PAGE_BLOCKS * class_size[cls]));
+    unsigned int i;
+
+    if(p == NULL)
+        return NULL;
+    for(i = 0; i < p->npages; i++)
+        page_map[((char *)p - st.first) / PAGE_BYTES + i] = p;
+    p->kind = KIND_SMALL;
+    p->bsize = class_size[cls];
+    p->cls = cls;
+    p->capacity = (p->npages * PAGE_BYTES - HDR_BYTES) / p->bsize;
+    span_color(p, p->capacity * p->bsize, p->bsize, &st.color[cls]);
+    p->carved = 0;
+    p->used = 0;
+    p->free = NULL;
+    p->deferred = NULL;
+    p->queued = 1;
+    list_push(&st.queue[cls], p);
+    return p;
+}
+
+/* Take a block from a page, or return NULL if it is full. */
+static void *page_take(page_t *p)
+{
+    void *bp;
+
+    if(p->free == NULL)
+    {
+        p->free = p->deferred;
+        p->deferred = NULL;
+    }
+    if(p->free != NULL)
+    {
+        bp = p->free;
+        p->free = NEXT_FREE(bp);
+    }
+    else if(p->carved < p->capacity)
+        bp = (char *)p + p->offset + p->carved++ * p->bsize;
+    else
+        return NULL;
+    p->used++;
+    return bp;
+}
+
+/*
+ * mm_init - Start with an empty heap.
+ */
+int mm_init(void)
+{
+    memset(&st, 0, sizeof(st));
+    st.first = mem_heap_lo();
+    init_classes();
+    return 0;
+}
+
+/*
+ * mm_malloc - Take a block from the first page in the class's queue that
+ * has one, or give a large request a span of its own.
+ */
+void *mm_malloc(size_t size)
+{
+    unsigned int cls;
+    page_t *p;
+    void *bp;
+
+    if(size == 0)
+        return NULL;
+    if(size > SMALL_MAX)
+    {
+        p = span_alloc(PAGES(HDR_BYTES + size));
+        if(p == NULL)
+            return NULL;
+        page_map[((char *)p - st.first) / PAGE_BYTES] = p;
+        p->kind = KIND_LARGE;
+        p->bsize = size;
+        span_color(p, size, 0, &st.color[CLASSES]);
+        return (char *)p + p->offset;
+    }
+
+    cls = class_of[(size + GRAIN - 1) / GRAIN];
+    while((p = st.queue[cls]) != NULL)
+    {
+        if((bp = page_take(p)) != NULL)
+            return bp;
+        /* Full pages leave the queue until a block in them is freed */
+        list_remove(&st.queue[cls], p);
+        p->queued = 0;
+    }
+    if((p = page_new(cls)) == NULL)
+        return NULL;
+    return page_take(p);
+}
+
+/*
+ * mm_malloc_hinted - Ignore the hints; the blocks of each size class already
+ * get pages of their own.
+ */
+void *mm_malloc_hinted(size_t size, int flags)
+{
+    return mm_malloc(size);
+}
+
+/*
+ * mm_free - Put a small block on its page's deferred list, and give the page
+ * back once it is empty. A large block's span is given back at once.
+ */
+void mm_free(void *ptr)
+{
+    page_t *p = page_of(ptr);
+    page_t *head;
+
+    if(p->kind == KIND_LARGE)
+    {
+        span_free(p);
+        return;
+    }
+
+    NEXT_FREE(ptr) = p->deferred;
+    p->deferred = ptr;
+    p->used--;
+    if(!p->queued)
+    {
+        /* Back in the queue, but behind the page that is being used */
+        head = st.queue[p->cls];
+        if(head == NULL)
+            list_push(&st.queue[p->cls], p);
+        else
+        {
+            p->prev = head;
+            p->next = head->next;
+            if(head->next != NULL)
+                head->next->prev = p;
+            head->next = p;
+        }
+        p->queued = 1;
+    }
+    if(p->used == 0 && p != st.queue[p->cls])
+    {
+        list_remove(&st.queue[p->cls], p);
+        span_free(p);
+    }
+}
+
+/*
+ * mm_realloc - Keep the block if it is already big enough, grow a large
+ * block into the free spans after it or at the end of the heap, and
+ * otherwise move it.
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    page_t *p;
+    size_t oldsize;
+    unsigned int npages;
+    void *newptr;
+
+    if(ptr == NULL)
+        return mm_malloc(size);
+    if(size == 0)
+    {
+        mm_free(ptr);
+        return NULL;
+    }
+
+    p = page_of(ptr);
+    oldsize = p->bsize;
+    if(p->kind == KIND_SMALL)
+    {
+        if(size <= p->bsize)
+            return ptr;
+    }
+    else if(size > SMALL_MAX)
+    {
+        npages = PAGES(p->offset + size);
+        span_merge(p);
+        if(p->npages < npages && p == st.last)
+        {
+            if(mem_sbrk((npages - p->npages) * PAGE_BYTES) == (void *)-1)
+                return NULL;
+            p->npages = npages;
+        }
+        if(p->npages >= npages)
+        {
+            span_split(p, npages);
+            p->bsize = size;
+            return ptr;
+        }
+    }
+
+    if((newptr = mm_malloc(size)) == NULL)
+        return NULL;
+    memcpy(newptr, ptr, MIN(oldsize, size));
+    mm_free(ptr);
+    return newptr;
+}
+
+/*
+ * mm_heapwalk - Visit every span in address order. A small page is visited
+ * as its header, then each block carved from it, then the rest of the page.
+ */
+void mm_heapwalk(mm_visit_funct visit, void *arg)
+{
+    char *brk = (char *)mem_heap_hi() + 1;
+    char isfree[PAGE_BYTES / GRAIN + PAGE_BLOCKS];
+    page_t *s;
+    char *bp;
+    unsigned int i;
+
+    for(s = (page_t *)st.first; (char *)s < brk; s = (page_t *)SPAN_END(s))
+    {
+        if(s->kind != KIND_SMALL)
+        {
+            visit(s, (size_t)s->npages * PAGE_BYTES, s->kind == KIND_LARGE, arg);
+            continue;
+        }
+
+        memset(isfree, 0, sizeof(isfree));
+        for(bp = s->free; bp != NULL; bp = NEXT_FREE(bp))
+            isfree[(bp - (char *)s - s->offset) / s->bsize] = 1;
+        for(bp = s->deferred; bp != NULL; bp = NEXT_FREE(bp))
+            isfree[(bp - (char *)s - s->offset) / s->bsize] = 1;
+
+        visit(s, s->offset, 1, arg);
+        bp = (char *)s + s->offset;
+        for(i = 0; i < s->carved; i++, bp += s->bsize)
+            visit(bp, s->bsize, !isfree[i], arg);
+        if(bp < SPAN_END(s))
+            visit(bp, SPAN_END(s) - bp, 0, arg);
+    }
+}
+
+/*
+ * mm_snapshot - Save the state beside the heap in the heap file and write the
+ * heap out. The page headers and free lists are in the heap already.
+ */
+int mm_snapshot(void)
+{
+    state_t *saved = mem_meta();
+
+    if(saved == NULL || sizeof(state_t) > MEM_META_BYTES)
+        return -1;
+    st.magic = PAGES_MAGIC;
+    memcpy(saved, &st, sizeof(st));
+    return mem_snapshot();
+}
+
+/*
+ * mm_restore - Resume from a snapshot taken by mm_pages.c with the heap
+ * at the same address, and rebuild the page map from the span headers.
+ */
+int mm_restore(void)
+{
+    state_t *saved = mem_meta();
+    char *brk = (char *)mem_heap_hi() + 1;
+    page_t *s;
+    unsigned int i;
+
+    if(saved == NULL || saved->magic != PAGES_MAGIC || saved->first != (char *)mem_heap_lo())
+        return -1;
+    memcpy(&st, saved, sizeof(st));
+    init_classes();
+    for(s = (page_t *)st.first; (char *)s < brk; s = (page_t *)SPAN_END(s))
+        for(i = 0; i < s->npages; i++)
+            page_map[((char *)s - st.first) / PAGE_BYTES + i] = s;
+    return 0;
+}
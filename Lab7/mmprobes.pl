@@ -0,0 +1,118 @@
+#!/usr/bin/perl
+use Getopt::Long qw(:config no_ignore_case bundling);
+
+#######################################################################
+# mmprobes - latency by size class from mm.c's static tracepoints
+#
+# Reads the "perf script" output of a recording of the mm provider's
+# probes (see the top of mm.c), pairs each *_entry with the *_return
+# that follows it on the same thread, and prints, for every operation
+# and size class, how many calls there were, their latency
+# percentiles, how many list nodes they stepped over, and how often
+# they grew the heap, split a block or coalesced. For example:
+#
+#   unix> perf buildid-cache --add ./mdriver
+#   unix> perf record -e 'sdt_mm:*' -- ./mdriver -f traces/amptjp-bal.rep
+#   unix> perf script --ns | ./mmprobes.pl
+#
+# The latencies include the cost of the probes themselves, which is
+# much larger than that of a typical mm_malloc, so they are best read
+# relative to each other: a class whose p99 stands out, and whose walk
+# or extend columns stand out with it, is where to look.
+#
+#######################################################################
+
+$| = 1; # autoflush output on every print statement
+
+# The argument that carries the size class, in each operation's probes
+%class_arg = ("malloc_return" => 3, "realloc_return" => 3, "free_entry" => 3);
+
+#
+# void usage(void) - print help message and terminate
+#
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] [-o <op>] [<perf script output> ...]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h       Print this message\n";
+    printf STDERR "  -o <op>  Only report on malloc, free or realloc\n";
+    printf STDERR "Reads standard input if no file is given.\n";
+    die "\n";
+}
+
+#
+# percentile(p, sorted) - the p'th percentile of a sorted list
+#
+sub percentile
+{
+    my ($p, $sorted) = @_;
+    my $i = int($p / 100 * (@$sorted - 1) + 0.5);
+
+    return $sorted->[$i];
+}
+
+GetOptions("h" => \$help, "o=s" => \$only) or usage("");
+usage("") if $help;
+usage("$0: -o must be malloc, free or realloc")
+    if defined($only) && $only !~ /^(malloc|free|realloc)$/;
+
+# Calls in progress, by thread
+%open = ();
+$events = 0;
+
+while (my $line = <>) {
+    # e.g. " mdriver  4242 [000]  3955.623899964: sdt_mm:malloc_entry: (401000) arg1=2040"
+    next unless $line =~ /^\s*.*?\s(\d+)(?:\/(\d+))?\s+\[\d+\]\s+([\d.]+):\s+(?:sdt_)?mm:(\w+):\s*(.*)$/;
+    my ($tid, $time, $probe, $rest) = (defined($2) ? $2 : $1, $3, $4, $5);
+    my @args = ();
+    while ($rest =~ /arg(\d+)=(\S+)/g) {
+        my ($i, $value) = ($1, $2);
+        $args[$i] = ($value =~ /^0x/i) ? hex($value) : $value;
+    }
+    $events++;
+
+    if ($probe =~ /^(malloc|free|realloc)_entry$/) {
+        # An entry with no return before it was a failed call; drop it
+        $open{$tid} = {op => $1, start => $time, class => $args[$class_arg{$probe}],
+                       extend_heap => 0, split => 0, coalesce => 0};
+    }
+    elsif ($probe =~ /^(malloc|free|realloc)_return$/) {
+        my ($op, $call) = ($1, $open{$tid});
+        next unless defined($call) && $call->{op} eq $op;
+        delete $open{$tid};
+        my $class = defined($class_arg{$probe}) ? $args[$class_arg{$probe}] : $call->{class};
+        my $key = "$op $class";
+        push @{$lat{$key}}, ($time - $call->{start}) * 1e9;
+        $walk{$key} += ($op eq "free") ? $args[2] : $args[4];
+        $extend{$key}++ if $call->{extend_heap};
+        $split{$key}++ if $call->{split};
+        $coalesce{$key}++ if $call->{coalesce};
+    }
+    elsif (defined($open{$tid})) {
+        # extend_heap, split and coalesce are charged to the call they are in
+        $open{$tid}->{$probe}++;
+    }
+}
+
+die "$0: No mm probe events in the input\n" unless $events;
+
+printf("%-8s %5s %9s %8s %8s %8s %9s %7s %7s %7s %7s\n",
+       "op", "class", "calls", "mean ns", "p50 ns", "p99 ns", "max ns",
+       "walk", "extend", "split", "coal");
+foreach my $op ("malloc", "free", "realloc") {
+    next if defined($only) && $op ne $only;
+    foreach my $key (sort { (split(/ /, $a))[1] <=> (split(/ /, $b))[1] }
+                     grep { /^$op / } keys %lat) {
+        my @sorted = sort { $a <=> $b } @{$lat{$key}};
+        my $n = @sorted;
+        my $sum = 0;
+        $sum += $_ foreach @sorted;
+        printf("%-8s %5d %9d %8.0f %8.0f %8.0f %9.0f %7.1f %6.1f%% %6.1f%% %6.1f%%\n",
+               $op, (split(/ /, $key))[1], $n, $sum / $n,
+               percentile(50, \@sorted), percentile(99, \@sorted), $sorted[-1],
+               $walk{$key} / $n, 100 * $extend{$key} / $n,
+               100 * $split{$key} / $n, 100 * $coalesce{$key} / $n);
+    }
+}
+exit;
@@ -0,0 +1,334 @@
+#!/usr/bin/perl
+use Getopt::Long qw(:config no_ignore_case bundling);
+use Cwd qw(abs_path);
+use File::Path qw(rmtree);
+use File::Basename qw(basename);
+
+#######################################################################
+# mmtune - search for the mm.c constants that score best on a trace set
+#
+# Each candidate is a setting of the tunable constants in mm.c
+# (SEGLIST_LEVEL, CHUNKSIZE, REALLOCCHUNK, LARGEBLOCK, and the quick
+# list limits QUICK_LISTS and QUICK_LIMIT). mmtune builds a private
+# mdriver for every candidate with those constants passed in through
+# MMFLAGS, and scores it the way mdriver computes its performance
+# index:
+#
+#   score = w * util + (1 - w) * min(1, throughput / target)
+#
+# where w defaults to UTIL_WEIGHT and target to AVG_LIBC_THRUPUT from
+# config.h.
+#
+# The search is a successive-halving bandit. The mm.c defaults plus
+# randomly drawn candidates are each run once over the traces. Then
+# the worse half is dropped, the survivors are run again, and so on
+# until one is left. Utilization is the same on every run, but
+# throughput is noisy, so a candidate's throughput is the mean over
+# all of its runs, and the close calls at the end are the ones that
+# get the most runs. Up to -j candidates are built and run at once.
+#
+# The winner is written as a header that mm.c picks up when it is
+# built with "make MMFLAGS=-DMM_TUNED".
+#
+#######################################################################
+
+$| = 1; # autoflush output on every print statement
+
+# The constants and the values searched for each, in mm.c order
+@names = ("SEGLIST_LEVEL", "CHUNKSIZE", "REALLOCCHUNK", "LARGEBLOCK",
+	  "QUICK_LISTS", "QUICK_LIMIT");
+%space = (
+    "SEGLIST_LEVEL" => [12, 14, 16, 18, 20, 22, 24],
+    "CHUNKSIZE"     => [256, 512, 1024, 2048, 4096, 8192, 16384],
+    "REALLOCCHUNK"  => [4096, 8192, 16384, 24576, 32768, 65536],
+    "LARGEBLOCK"    => [32, 64, 96, 128, 192, 256, 512],
+    "QUICK_LISTS"   => [1, 2, 4, 8, 16, 32],
+    "QUICK_LIMIT"   => [0, 4, 8, 16, 32, 64, 256],
+);
+# Their column headings
+%heading = (
+    "SEGLIST_LEVEL" => "levels", "CHUNKSIZE" => "chunk", "REALLOCCHUNK" => "rchunk",
+    "LARGEBLOCK" => "large", "QUICK_LISTS" => "qlists", "QUICK_LIMIT" => "qlimit",
+);
+
+#
+# void usage(void) - print help message and terminate
+#
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-hk] [-n <cands>] [-j <jobs>] [-S <seed>] [-w <weight>]\n";
+    printf STDERR "          [-T <ops/sec>] [-t <tracedir>] [-s <srcdir>] [-d <workdir>]\n";
+    printf STDERR "          [-c <cflags>] [-p NAME=v1,v2,...] [-L <secs>] [-o <file>]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h             Print this message\n";
+    printf STDERR "  -k             Keep the work directory\n";
+    printf STDERR "  -n <cands>     Number of candidates, including the defaults (default 16)\n";
+    printf STDERR "  -j <jobs>      Candidates built and run at once (default: online CPUs)\n";
+    printf STDERR "  -S <seed>      Random seed for drawing candidates (default 1)\n";
+    printf STDERR "  -w <weight>    Weight of utilization in the score (default UTIL_WEIGHT)\n";
+    printf STDERR "  -T <ops/sec>   Throughput that earns full marks (default AVG_LIBC_THRUPUT)\n";
+    printf STDERR "  -t <tracedir>  Directory of the default traces (default <srcdir>/traces)\n";
+    printf STDERR "  -s <srcdir>    Directory with mm.c, mdriver.c and the Makefile (default .)\n";
+    printf STDERR "  -d <workdir>   Where to build the candidates (default /tmp/mmtune.<pid>)\n";
+    printf STDERR "  -c <cflags>    CFLAGS to build with (default: the Makefile's)\n";
+    printf STDERR "  -p NAME=v,...  Values to search for constant NAME (repeatable)\n";
+    printf STDERR "  -L <secs>      Give up on a run that takes longer (default 600)\n";
+    printf STDERR "  -o <file>      Header to write the winner to (default mm_tuned.h)\n";
+    die "\n";
+}
+
+#
+# config_value(file, name) - the value of a #define in a C file
+#
+sub config_value
+{
+    my ($file, $name) = @_;
+    my ($value, $line);
+
+    open(CONFIG, $file) or die "$0: Could not open $file: $!\n";
+    while (defined($line = <CONFIG>)) {
+	if ($line =~ /^\s*#define\s+$name\s+(.*?)\s*(\/\*.*)?$/) {
+	    $value = $1;
+	    last;
+	}
+    }
+    close(CONFIG);
+    defined($value) or die "$0: No #define $name in $file\n";
+    return $value;
+}
+
+#
+# flags(cand) - the MMFLAGS that build candidate cand
+#
+sub flags
+{
+    my ($cand) = @_;
+    return join(" ", map { "-D$_=$cand->{vals}{$_}" } @names);
+}
+
+#
+# label(cand) - one-line description of candidate cand
+#
+sub label
+{
+    my ($cand) = @_;
+    return join(" ", map { sprintf("%6d", $cand->{vals}{$_}) } @names);
+}
+
+#
+# run_parallel(cmds) - run the shell commands in @cmds, at most $jobs
+#     at a time, and return their exit statuses in the same order
+#
+sub run_parallel
+{
+    my @cmds = @_;
+    my (%running, @status, $pid, $next);
+
+    for ($next = 0; $next < @cmds || %running; ) {
+	if ($next < @cmds && keys(%running) < $jobs) {
+	    $pid = fork();
+	    defined($pid) or die "$0: fork failed: $!\n";
+	    if ($pid == 0) {
+		exec("/bin/sh", "-c", $cmds[$next]);
+		exit(127);
+	    }
+	    $running{$pid} = $next++;
+	    next;
+	}
+	$pid = wait();
+	$status[$running{$pid}] = $?;
+	delete $running{$pid};
+    }
+    return @status;
+}
+
+#
+# read_run(file, cand) - add the results of one mdriver --csv run to
+#     candidate cand. Returns 0 if any trace was invalid.
+#
+sub read_run
+{
+    my ($file, $cand) = @_;
+    my ($util, $ops, $secs, $n, $line, @f);
+
+    open(CSV, $file) or return 0;
+    $util = $ops = $secs = $n = 0;
+    $line = <CSV>;  # the header
+    while (defined($line = <CSV>)) {
+	$line =~ s/^"(?:[^"]|"")*"//;  # a quoted trace name may have commas
+	@f = split(/,/, $line);
+	next if $f[1] ne "mm";
+	return 0 if !$f[2];
+	$util += $f[3];
+	$ops += $f[4];
+	$secs += $f[5];
+	$n++;
+    }
+    close(CSV);
+    return 0 if $n == 0 || $secs <= 0;
+
+    $cand->{util} = $util / $n;
+    $cand->{thru} = ($cand->{thru} * $cand->{runs} + $ops / $secs) /
+	($cand->{runs} + 1);
+    $cand->{runs}++;
+    return 1;
+}
+
+#
+# score(cand) - the performance index of candidate cand, out of 100
+#
+sub score
+{
+    my ($cand) = @_;
+    my $thru = $cand->{thru} / $target;
+
+    $thru = 1 if $thru > 1;
+    return 100 * ($weight * $cand->{util} + (1 - $weight) * $thru);
+}
+
+#
+# Parse and check the command line arguments
+#
+$ncands = 16;
+$seed = 1;
+$src = ".";
+$outfile = "mm_tuned.h";
+$limit = 600;
+@ranges = ();
+GetOptions("h" => \$help, "k" => \$keep, "n=i" => \$ncands,
+	   "j=i" => \$jobs, "S=i" => \$seed, "w=f" => \$weight,
+	   "T=f" => \$target, "t=s" => \$tracedir, "s=s" => \$src,
+	   "d=s" => \$work, "c=s" => \$cflags, "p=s" => \@ranges,
+	   "L=i" => \$limit, "o=s" => \$outfile)
+    or usage("");
+usage("") if $help || @ARGV;
+usage("Need at least 2 candidates") if $ncands < 2;
+
+$src = abs_path($src);
+-f "$src/mm.c" && -f "$src/Makefile" or die "$0: No mm.c and Makefile in $src\n";
+$tracedir = abs_path(defined($tracedir) ? $tracedir : "$src/traces") . "/";
+$weight = config_value("$src/config.h", "UTIL_WEIGHT") unless defined($weight);
+$target = config_value("$src/config.h", "AVG_LIBC_THRUPUT") unless defined($target);
+usage("The weight must be between 0 and 1") if $weight < 0 || $weight > 1;
+if (!$jobs) {
+    chomp($jobs = `getconf _NPROCESSORS_ONLN 2>/dev/null`);
+    $jobs = 1 if !$jobs || $jobs < 1;
+}
+$work = "/tmp/mmtune.$$" unless defined($work);
+
+foreach (@ranges) {
+    my ($name, $vals) = split(/=/, $_, 2);
+    exists($space{$name}) or usage("Unknown constant $name");
+    $space{$name} = [grep { /^\d+$/ } split(/,/, $vals)];
+    @{$space{$name}} or usage("No values for $name");
+}
+
+#
+# Draw the candidates: the mm.c defaults, then distinct random points
+#
+srand($seed);
+$default = {vals => {}};
+foreach $name (@names) {
+    $value = config_value("$src/mm.c", $name);
+    $value =~ s/^\(\s*(\d+)\s*<<\s*(\d+)\s*\)$/$1 << $2/e;
+    $default->{vals}{$name} = $value;
+}
+@cands = ($default);
+%seen = (flags($default) => 1);
+$points = 1;
+$points *= @{$space{$_}} foreach @names;
+while (@cands < $ncands && keys(%seen) < $points + 1) {
+    my $cand = {vals => {}};
+    foreach $name (@names) {
+	my $vals = $space{$name};
+	$cand->{vals}{$name} = $vals->[int(rand(@$vals))];
+    }
+    next if $seen{flags($cand)}++;
+    push(@cands, $cand);
+}
+$cands[$_]{id} = $_ foreach (0..$#cands);
+
+#
+# Build a private mdriver for each candidate
+#
+printf("Building %d candidates in %s (%d at a time)\n",
+       scalar(@cands), $work, $jobs);
+mkdir($work) or -d $work or die "$0: Could not create $work: $!\n";
+@cmds = ();
+foreach $cand (@cands) {
+    my $dir = "$work/c$cand->{id}";
+    my $make = "make -s mdriver MMFLAGS='" . flags($cand) . "'";
+    $make .= " CFLAGS='$cflags'" if defined($cflags);
+    $cand->{dir} = $dir;
+    push(@cmds, "rm -rf $dir && mkdir $dir && cp $src/*.c $src/*.h " .
+	 "$src/Makefile $dir && cd $dir && $make > build.log 2>&1");
+}
+@status = run_parallel(@cmds);
+@alive = ();
+foreach $cand (@cands) {
+    if ($status[$cand->{id}]) {
+	printf STDERR "$0: Candidate %s did not build (see %s/build.log)\n",
+	    flags($cand), $cand->{dir};
+	next;
+    }
+    push(@alive, $cand);
+}
+$default->{id} == 0 && !$status[0] or die "$0: The mm.c defaults did not build\n";
+
+#
+# Successive halving: run every survivor once more, keep the better half
+#
+for ($round = 1; ; $round++) {
+    @cmds = map { "cd $_->{dir} && timeout $limit ./mdriver -a -t $tracedir " .
+		      "--csv run$round.csv > run$round.log 2>&1" } @alive;
+    run_parallel(@cmds);
+    @alive = grep { read_run("$_->{dir}/run$round.csv", $_) or
+			(printf(STDERR "$0: Candidate %s failed (see %s/run%d.log)\n",
+				flags($_), $_->{dir}, $round), 0) } @alive;
+    @alive or die "$0: Every candidate failed\n";
+    @alive = sort { score($b) <=> score($a) } @alive;
+
+    printf("\nRound %d: %d candidates\n", $round, scalar(@alive));
+    printf("%5s  %s  %6s %9s %6s %5s\n", "cand",
+	   join(" ", map { sprintf("%6.6s", $heading{$_}) } @names),
+	   "util", "Kops", "score", "runs");
+    foreach $cand (@alive) {
+	printf("%5d  %s  %5.1f%% %9.0f %6.2f %5d\n", $cand->{id}, label($cand),
+	       100 * $cand->{util}, $cand->{thru} / 1e3, score($cand),
+	       $cand->{runs});
+    }
+    last if @alive == 1;
+    splice(@alive, int((@alive + 1) / 2));
+}
+$best = $alive[0];
+
+if ((grep { $_->{thru} < $target } @cands) == 0) {
+    printf("\nNote: every candidate beat %.0f ops/sec, so only utilization " .
+	   "counted.\nUse -T to reward throughput above that.\n", $target);
+}
+
+#
+# Write the winner's constants as a header for mm.c
+#
+open(OUT, ">$outfile") or die "$0: Could not open $outfile: $!\n";
+print OUT "/*\n";
+print OUT " * " . basename($outfile) . " - mm.c constants chosen by mmtune.pl. Build mm.c with\n";
+print OUT " *     \"make MMFLAGS=-DMM_TUNED\" to use them.\n";
+print OUT " *\n";
+printf OUT " * Score %.2f (util %.1f%%, %.0f Kops) with weight %.2f and\n",
+    score($best), 100 * $best->{util}, $best->{thru} / 1e3, $weight;
+printf OUT " * target %.0f ops/sec, over the default traces in %s.\n",
+    $target, $tracedir;
+printf OUT " * The mm.c defaults scored %.2f.\n", score($default)
+    if $default->{runs};
+print OUT " */\n";
+print OUT "#ifndef __MM_TUNED_H_\n#define __MM_TUNED_H_\n\n";
+printf OUT "#define %-13s %d\n", $_, $best->{vals}{$_} foreach @names;
+print OUT "\n#endif /* __MM_TUNED_H_ */\n";
+close(OUT);
+
+printf("\nBest: %s (score %.2f) written to %s\n", flags($best),
+       score($best), $outfile);
+rmtree($work) unless $keep;
+exit(0);
@@ -0,0 +1,161 @@
+/*
+ * perfctr.c - Count hardware events using the Linux perf_event_open
+ *     interface.
+ *
+ * Each event is opened as its own counter (rather than as one group)
+ * so that a single event the CPU doesn't support, or that the kernel
+ * won't let us see, doesn't take the others down with it. When there
+ * are more events than hardware counters the kernel multiplexes them,
+ * and we scale each reading by time_enabled/time_running.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "perfctr.h"
+
+#if defined(__linux__) && defined(SYS_perf_event_open)
+#include <linux/perf_event.h>
+#define HAVE_PERF_EVENTS 1
+#else
+#define HAVE_PERF_EVENTS 0
+#endif
+
+char *perfctr_names[PC_NUM] = {
+    "Kcyc", "Kinstr", "KL1Dmiss", "KLLCmiss", "KdTLBmiss", "Kbrmiss", "faults"
+};
+
+static int fds[PC_NUM] = {-1, -1, -1, -1, -1, -1, -1};
+
+#if HAVE_PERF_EVENTS
+
+/* Cache event config: (cache id) | (op << 8) | (result << 16) */
+#define CACHE_EVENT(id, op, res) \
+    ((id) | ((op) << 8) | ((res) << 16))
+
+static struct {
+    unsigned type;
+    unsigned long long config;
+} events[PC_NUM] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D,
+				     PERF_COUNT_HW_CACHE_OP_READ,
+				     PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB,
+				     PERF_COUNT_HW_CACHE_OP_READ,
+				     PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+/* What a read() of one counter returns with our read_format */
+struct readval {
+    unsigned long long value;
+    unsigned long long time_enabled;
+    unsigned long long time_running;
+};
+
+/*
+ * perfctr_init - Open the event counters for this process
+ */
+int perfctr_init(void)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    for (i = 0; i < PC_NUM; i++) {
+	if (fds[i] >= 0)
+	    close(fds[i]);
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;  /* allowed at perf_event_paranoid <= 2 */
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[i] >= 0)
+	    n++;
+    }
+    return n;
+}
+
+/*
+ * perfctr_start - Reset and enable the counters
+ */
+void perfctr_start(void)
+{
+    int i;
+
+    for (i = 0; i < PC_NUM; i++) {
+	if (fds[i] >= 0) {
+	    ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+    }
+}
+
+/*
+ * perfctr_stop - Disable the counters and read them into *ctrs
+ */
+void perfctr_stop(perfctr_t *ctrs)
+{
+    struct readval rv;
+    int i;
+
+    for (i = 0; i < PC_NUM; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < PC_NUM; i++) {
+	ctrs->valid[i] = 0;
+	ctrs->count[i] = 0;
+	if (fds[i] < 0 || read(fds[i], &rv, sizeof(rv)) != sizeof(rv))
+	    continue;
+	if (rv.time_running == 0) /* never got scheduled on the PMU */
+	    continue;
+	ctrs->valid[i] = 1;
+	ctrs->count[i] = (double)rv.value;
+	if (rv.time_running < rv.time_enabled)
+	    ctrs->count[i] *= (double)rv.time_enabled / rv.time_running;
+    }
+}
+
+#else /* !HAVE_PERF_EVENTS */
+
+/* No perf events on this platform, so nothing is ever available */
+int perfctr_init(void)
+{
+    return 0;
+}
+
+void perfctr_start(void)
+{
+}
+
+void perfctr_stop(perfctr_t *ctrs)
+{
+    memset(ctrs, 0, sizeof(*ctrs));
+}
+
+#endif
+
+/*
+ * perfctr_deinit - Close all of the event counters
+ */
+void perfctr_deinit(void)
+{
+    int i;
+
+    for (i = 0; i < PC_NUM; i++) {
+	if (fds[i] >= 0)
+	    close(fds[i]);
+	fds[i] = -1;
+    }
+}
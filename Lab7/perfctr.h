@@ -0,0 +1,44 @@
+/*
+ * perfctr.h - prototypes for the routines in perfctr.c that count
+ *     hardware events (cycles, cache and TLB misses, ...) while a
+ *     test function runs
+ */
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+/* The events we try to count, in the order they are printed */
+#define PC_CYCLES      0   /* CPU cycles */
+#define PC_INSTRS      1   /* retired instructions */
+#define PC_L1D_MISS    2   /* L1 data cache read misses */
+#define PC_LLC_MISS    3   /* last level cache misses */
+#define PC_DTLB_MISS   4   /* data TLB read misses */
+#define PC_BRANCH_MISS 5   /* mispredicted branches */
+#define PC_PAGE_FAULTS 6   /* page faults (software event) */
+#define PC_NUM         7
+
+/* One set of counter readings */
+typedef struct {
+    int valid[PC_NUM];     /* was event i counted? */
+    double count[PC_NUM];  /* event counts, scaled for multiplexing */
+} perfctr_t;
+
+/* Short column names for each event */
+extern char *perfctr_names[PC_NUM];
+
+/*
+ * perfctr_init - Open the event counters for this process.
+ *     Returns the number of events that are available (0 if the
+ *     kernel or the CPU won't let us count anything).
+ */
+int perfctr_init(void);
+
+/* perfctr_deinit - Close all of the event counters */
+void perfctr_deinit(void);
+
+/* perfctr_start - Reset and enable the counters */
+void perfctr_start(void);
+
+/* perfctr_stop - Disable the counters and read them into *ctrs */
+void perfctr_stop(perfctr_t *ctrs);
+
+#endif /* __PERFCTR_H_ */
@@ -0,0 +1,482 @@
+/*
+ * gentrace.c - Generate synthetic Malloc Lab traces
+ *
+ * Unlike the gen_*.pl scripts, which each produce one fixed pattern,
+ * gentrace draws the size of each block, its lifetime (in requests)
+ * and the growth factor of each realloc from distributions given on
+ * the command line. The same seed always produces the same trace.
+ *
+ * The trace is written as it is generated. Only the live blocks are
+ * kept in memory, in a heap ordered by the request at which each one
+ * is due to be freed, so traces of billions of requests are fine as
+ * long as the number of live blocks stays reasonable. (mdriver itself
+ * reads the request count into an int, so it can't replay traces of
+ * more than 2^31-1 requests.)
+ *
+ * Every trace is balanced: each block id is allocated exactly once and
+ * freed exactly once, so the output passes checktrace.pl -s as is.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#define MAXLINE 1024        /* max string size */
+#define OUTBUF (1<<16)      /* output buffer size */
+#define MAX_ZIPF (1<<20)    /* max number of values in a Zipf distribution */
+
+/* A distribution to draw sizes, lifetimes or growth factors from */
+typedef struct {
+    enum {CONST, UNIFORM, LOGNORMAL, ZIPF} type;
+    double a, b, c;   /* CONST: a; UNIFORM: [a, b]; LOGNORMAL: median a,
+			 sigma b; ZIPF: values 1..a times c, exponent b */
+    double *cdf;      /* ZIPF: cumulative probabilities of 1..a */
+} dist_t;
+
+/* A live block, in the heap of pending frees */
+typedef struct {
+    long long due;    /* request at which the block should be freed */
+    long long id;     /* block id */
+    int size;         /* current payload size */
+} block_t;
+
+/*
+ * Global variables
+ */
+static unsigned long long rng_state;   /* for rng() */
+static block_t *heap = NULL;           /* live blocks, min-heap on due */
+static long long nlive = 0, maxlive = 0;
+static char outbuf[OUTBUF];            /* output buffer... */
+static int outlen = 0;                 /* ...and the bytes in it */
+static FILE *outfp;
+static int nthreads = 1;               /* -t: threads to tag requests with */
+static long long queue_depth = 0;      /* -c: producer/consumer queue depth */
+static long long short_life = 0;       /* -H: hint lifetimes below this "s" */
+static double hot_frac = 0;            /* -w: fraction of blocks hinted hot */
+
+/* Function prototypes */
+static unsigned long long rng(void);
+static double uniform01(void);
+static double normal01(void);
+static void parse_dist(char *spec, dist_t *d, char *what);
+static double draw(dist_t *d);
+static void heap_push(block_t *b);
+static void heap_pop(block_t *b);
+static int thread_of(long long id, int consumer);
+static void put_request(char type, long long id, int size, int tid, char *hint);
+static void put_str(char *s);
+static void put_num(long long x);
+static void flush_out(void);
+static void usage(void);
+static void app_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    long long num_ops = 10000;     /* -n: requests in the trace */
+    unsigned long long seed = 1;   /* -S: random seed */
+    double realloc_frac = 0;       /* -r: fraction of requests that realloc */
+    long long phase_len = 0;       /* -P: requests per phase (0: no phases) */
+    int max_size = 1 << 20;        /* -m: largest request */
+    char *size_spec = "lognormal:64:1.5";
+    char *life_spec = "lognormal:100:1.5";
+    char *growth_spec = "uniform:1:2";
+    char *outfile = NULL;
+    dist_t size_dist, life_dist, growth_dist;
+
+    long long num_ids, allocs_left, reallocs_left, op, next_id, life;
+    long long live_bytes = 0, peak_bytes = 0, peak_live = 0, phase_end = 0;
+    double phase_scale = 1.0, x;
+    block_t b;
+    int c, size, nhint;
+    char hint[4];
+
+    while ((c = getopt(argc, argv, "n:S:s:l:r:g:P:c:t:m:H:w:o:h")) != EOF) {
+	switch (c) {
+	case 'n': num_ops = atoll(optarg); break;
+	case 'S': seed = strtoull(optarg, NULL, 0); break;
+	case 's': size_spec = optarg; break;
+	case 'l': life_spec = optarg; break;
+	case 'r': realloc_frac = atof(optarg); break;
+	case 'g': growth_spec = optarg; break;
+	case 'P': phase_len = atoll(optarg); break;
+	case 'c': queue_depth = atoll(optarg); break;
+	case 't': nthreads = atoi(optarg); break;
+	case 'm': max_size = atoi(optarg); break;
+	case 'H': short_life = atoll(optarg); break;
+	case 'w': hot_frac = atof(optarg); break;
+	case 'o': outfile = optarg; break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (num_ops < 2 || realloc_frac < 0 || realloc_frac >= 1 ||
+	nthreads < 1 || max_size < 1 || phase_len < 0 || queue_depth < 0 ||
+	short_life < 0 || hot_frac < 0 || hot_frac > 1 ||
+	(queue_depth > 0 && nthreads > 1 && nthreads % 2)) {
+	usage();
+	exit(1);
+    }
+    parse_dist(size_spec, &size_dist, "size");
+    parse_dist(life_spec, &life_dist, "lifetime");
+    parse_dist(growth_spec, &growth_dist, "growth");
+
+    /*
+     * Every block is allocated once and freed once, so
+     * 2 * num_ids + reallocs = num_ops, and there must be a block
+     * for the reallocs to grow
+     */
+    reallocs_left = (long long)(realloc_frac * num_ops);
+    if ((num_ops - reallocs_left) % 2 && reallocs_left == 0) {
+	num_ops--;
+	fprintf(stderr, "gentrace: without reallocs the requests come in "
+		"pairs, so -n is rounded down to %lld\n", num_ops);
+    }
+    else if ((num_ops - reallocs_left) % 2)
+	reallocs_left++;
+    if (reallocs_left > num_ops - 2)
+	reallocs_left = num_ops - 2;
+    num_ids = allocs_left = (num_ops - reallocs_left) / 2;
+    rng_state = seed ^ 0x9E3779B97F4A7C15ULL;
+
+    if (outfile == NULL)
+	outfp = stdout;
+    else if ((outfp = fopen(outfile, "w")) == NULL) {
+	perror(outfile);
+	exit(1);
+    }
+    /* The suggested heap size is unused, and we don't know it yet */
+    put_num(20000);     put_str("\n");
+    put_num(num_ids);   put_str("\n");
+    put_num(num_ops);   put_str("\n");
+    put_num(1);         put_str("\n");
+
+    next_id = 0;
+    for (op = 0; op < num_ops; op++) {
+	/* A new phase brings new sizes; everything from the last one dies */
+	if (phase_len > 0 && op >= phase_end) {
+	    phase_end = op + phase_len;
+	    phase_scale = pow(2.0, floor(uniform01() * 5) - 2); /* 1/4..4 */
+	}
+
+	/*
+	 * Free the block that is due next if its time has come or if only
+	 * frees are left. Keep one block live while there are reallocs
+	 * left and nothing left to allocate.
+	 */
+	if (nlive > 0 &&
+	    (heap[0].due <= op || (allocs_left == 0 && reallocs_left == 0)) &&
+	    !(allocs_left == 0 && reallocs_left > 0 && nlive == 1)) {
+	    heap_pop(&b);
+	    live_bytes -= b.size;
+	    put_request('f', b.id, 0, thread_of(b.id, 1), NULL);
+	}
+
+	/* Realloc a random live block */
+	else if (nlive > 0 && reallocs_left > 0 &&
+		 (allocs_left == 0 ||
+		  uniform01() * (allocs_left + reallocs_left) < reallocs_left)) {
+	    block_t *rb = &heap[rng() % nlive];
+	    x = rb->size * draw(&growth_dist);
+	    size = (x < 1) ? 1 : (x > max_size) ? max_size : (int)x;
+	    live_bytes += size - rb->size;
+	    rb->size = size;
+	    put_request('r', rb->id, size, thread_of(rb->id, 0), NULL);
+	    reallocs_left--;
+	}
+
+	/* Allocate a new block and decide when it dies */
+	else {
+	    x = draw(&size_dist) * phase_scale;
+	    b.size = (x < 1) ? 1 : (x > max_size) ? max_size : (int)x;
+	    b.id = next_id++;
+	    if (queue_depth > 0)       /* consumed in FIFO order */
+		life = queue_depth;
+	    else if (phase_len > 0)    /* dies with its phase */
+		life = phase_end - op;
+	    else
+		life = (long long)draw(&life_dist);
+	    b.due = op + ((life < 1) ? 1 : life);
+	    heap_push(&b);
+	    live_bytes += b.size;
+
+	    /* Hint what we know: how long it lives, and maybe that it's hot */
+	    nhint = 0;
+	    if (short_life > 0)
+		hint[nhint++] = (b.due - op < short_life) ? 's' : 'l';
+	    if (hot_frac > 0 && uniform01() < hot_frac)
+		hint[nhint++] = 'h';
+	    hint[nhint] = '\0';
+	    put_request('a', b.id, b.size, thread_of(b.id, 0), hint);
+	    allocs_left--;
+	}
+
+	if (live_bytes > peak_bytes)
+	    peak_bytes = live_bytes;
+	if (nlive > peak_live)
+	    peak_live = nlive;
+    }
+    flush_out();
+    if (outfp != stdout)
+	fclose(outfp);
+
+    fprintf(stderr, "gentrace: %lld requests, %lld ids, "
+	    "peak %lld live blocks and %lld live bytes\n",
+	    num_ops, num_ids, peak_live, peak_bytes);
+    exit(0);
+}
+
+/*
+ * rng - Return 64 random bits (xorshift64*)
+ */
+static unsigned long long rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/* uniform01 - Return a random double in [0, 1) */
+static double uniform01(void)
+{
+    return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* normal01 - Return a standard normal random variable (Box-Muller) */
+static double normal01(void)
+{
+    double u = uniform01();
+
+    return sqrt(-2.0 * log(1.0 - u)) * cos(2 * M_PI * uniform01());
+}
+
+/*
+ * parse_dist - Parse a distribution spec: const:V, uniform:LO:HI,
+ *     lognormal:MEDIAN:SIGMA or zipf:N:S[:SCALE]
+ */
+static void parse_dist(char *spec, dist_t *d, char *what)
+{
+    char name[MAXLINE], msg[MAXLINE];
+    double sum;
+    int i, n;
+
+    memset(d, 0, sizeof(*d));
+    d->c = 1;
+    n = sscanf(spec, "%63[a-z]:%lf:%lf:%lf", name, &d->a, &d->b, &d->c);
+    if (n >= 2 && !strcmp(name, "const"))
+	d->type = CONST;
+    else if (n >= 3 && !strcmp(name, "uniform") && d->a <= d->b)
+	d->type = UNIFORM;
+    else if (n >= 3 && !strcmp(name, "lognormal") && d->a > 0 && d->b >= 0)
+	d->type = LOGNORMAL;
+    else if (n >= 3 && !strcmp(name, "zipf") && d->a >= 1 &&
+	     d->a <= MAX_ZIPF) {
+	/* Precompute the CDF of P(k) ~ 1/k^s, k = 1..n */
+	d->type = ZIPF;
+	n = (int)d->a;
+	if ((d->cdf = (double *)malloc(n * sizeof(double))) == NULL)
+	    app_error("malloc failed in parse_dist");
+	for (sum = 0, i = 0; i < n; i++)
+	    d->cdf[i] = (sum += pow(i + 1, -d->b));
+	for (i = 0; i < n; i++)
+	    d->cdf[i] /= sum;
+    }
+    else {
+	sprintf(msg, "Bad %s distribution: %.100s", what, spec);
+	app_error(msg);
+    }
+}
+
+/*
+ * draw - Draw a value from a distribution
+ */
+static double draw(dist_t *d)
+{
+    double u;
+    int lo, hi, mid;
+
+    switch (d->type) {
+    case CONST:
+	return d->a;
+    case UNIFORM:
+	return d->a + uniform01() * (d->b - d->a);
+    case LOGNORMAL:
+	return d->a * exp(d->b * normal01());
+    case ZIPF: /* binary search for the first k with cdf[k] > u */
+	u = uniform01();
+	lo = 0;
+	hi = (int)d->a - 1;
+	while (lo < hi) {
+	    mid = (lo + hi) / 2;
+	    if (d->cdf[mid] > u)
+		hi = mid;
+	    else
+		lo = mid + 1;
+	}
+	return (lo + 1) * d->c;
+    }
+    return 0;
+}
+
+/*
+ * heap_push - Add a live block to the heap of pending frees
+ */
+static void heap_push(block_t *b)
+{
+    long long i, parent;
+
+    if (nlive == maxlive) {
+	maxlive = maxlive ? 2 * maxlive : 1024;
+	if ((heap = (block_t *)realloc(heap, maxlive * sizeof(block_t))) == NULL)
+	    app_error("realloc failed in heap_push");
+    }
+    for (i = nlive++; i > 0; i = parent) {
+	parent = (i - 1) / 2;
+	if (heap[parent].due <= b->due)
+	    break;
+	heap[i] = heap[parent];
+    }
+    heap[i] = *b;
+}
+
+/*
+ * heap_pop - Remove the block that is due first from the heap
+ */
+static void heap_pop(block_t *b)
+{
+    block_t last;
+    long long i, child;
+
+    *b = heap[0];
+    last = heap[--nlive];
+    for (i = 0; (child = 2 * i + 1) < nlive; i = child) {
+	if (child + 1 < nlive && heap[child+1].due < heap[child].due)
+	    child++;
+	if (last.due <= heap[child].due)
+	    break;
+	heap[i] = heap[child];
+    }
+    heap[i] = last;
+}
+
+/*
+ * thread_of - Return the thread that issues a request on block id, or
+ *     -1 for a single-threaded trace. Each block belongs to one thread,
+ *     except in a producer/consumer trace, where the consumer (odd)
+ *     thread after the block's producer frees it.
+ */
+static int thread_of(long long id, int consumer)
+{
+    if (nthreads == 1)
+	return -1;
+    if (queue_depth > 0)
+	return (int)(id % (nthreads / 2)) * 2 + consumer;
+    return (int)(id % nthreads);
+}
+
+/*
+ * put_request - Write one request line, with a t=<tid> field if tid >= 0
+ *     and an h=<hint> field if hint isn't NULL or empty
+ */
+static void put_request(char type, long long id, int size, int tid, char *hint)
+{
+    char s[3] = {type, ' ', '\0'};
+
+    put_str(s);
+    put_num(id);
+    if (type != 'f') {
+	put_str(" ");
+	put_num(size);
+    }
+    if (tid >= 0) {
+	put_str(" t=");
+	put_num(tid);
+    }
+    if (hint != NULL && *hint != '\0') {
+	put_str(" h=");
+	put_str(hint);
+    }
+    put_str("\n");
+}
+
+/* put_str - Buffer a string for output */
+static void put_str(char *s)
+{
+    while (*s) {
+	if (outlen == OUTBUF)
+	    flush_out();
+	outbuf[outlen++] = *s++;
+    }
+}
+
+/* put_num - Buffer a nonnegative number for output, without printf */
+static void put_num(long long x)
+{
+    char digits[24];
+    int n = sizeof(digits) - 1;
+
+    digits[n] = '\0';
+    do {
+	digits[--n] = '0' + x % 10;
+	x /= 10;
+    } while (x > 0);
+    put_str(digits + n);
+}
+
+/* flush_out - Write out the output buffer */
+static void flush_out(void)
+{
+    if (outlen > 0 && fwrite(outbuf, 1, outlen, outfp) != (size_t)outlen) {
+	perror("gentrace: write");
+	exit(1);
+    }
+    outlen = 0;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: gentrace [-h] [-n <ops>] [-S <seed>] [-s <dist>] [-l <dist>]\n");
+    fprintf(stderr, "                [-r <frac> [-g <dist>]] [-P <len> | -c <depth>]\n");
+    fprintf(stderr, "                [-t <threads>] [-m <bytes>] [-H <reqs>] [-w <frac>]\n");
+    fprintf(stderr, "                [-o <file>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h           Print this message.\n");
+    fprintf(stderr, "\t-n <ops>     Number of requests (default 10000).\n");
+    fprintf(stderr, "\t-S <seed>    Random seed (default 1).\n");
+    fprintf(stderr, "\t-s <dist>    Block sizes (default lognormal:64:1.5).\n");
+    fprintf(stderr, "\t-l <dist>    Block lifetimes in requests (default lognormal:100:1.5).\n");
+    fprintf(stderr, "\t-r <frac>    Fraction of requests that are reallocs (default 0).\n");
+    fprintf(stderr, "\t-g <dist>    Realloc growth factors (default uniform:1:2).\n");
+    fprintf(stderr, "\t-P <len>     Phased: every <len> requests the sizes change by a\n");
+    fprintf(stderr, "\t             random factor of 1/4..4 and the blocks of the\n");
+    fprintf(stderr, "\t             previous phase are freed.\n");
+    fprintf(stderr, "\t-c <depth>   Producer/consumer: blocks are freed in the order\n");
+    fprintf(stderr, "\t             they were allocated, <depth> requests later. With\n");
+    fprintf(stderr, "\t             -t, even threads allocate and odd threads free.\n");
+    fprintf(stderr, "\t-t <threads> Tag each request with a thread (t=<tid>) for mdriver -T.\n");
+    fprintf(stderr, "\t-m <bytes>   Largest request (default 1048576).\n");
+    fprintf(stderr, "\t-H <reqs>    Hint each block's lifetime for mm_malloc_hinted: h=s\n");
+    fprintf(stderr, "\t             if it lives fewer than <reqs> requests, else h=l.\n");
+    fprintf(stderr, "\t-w <frac>    Also hint this fraction of the blocks hot (h).\n");
+    fprintf(stderr, "\t-o <file>    Write the trace to <file> instead of stdout.\n");
+    fprintf(stderr, "Distributions\n");
+    fprintf(stderr, "\tconst:V, uniform:LO:HI, lognormal:MEDIAN:SIGMA,\n");
+    fprintf(stderr, "\tzipf:N:S[:SCALE] (SCALE times k in 1..N, P(k) ~ 1/k^S)\n");
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "gentrace: %s\n", msg);
+    exit(1);
+}
@@ -0,0 +1,354 @@
+/*
+ * tracestat.c - Characterize the allocation workload in .rep trace files
+ *
+ * For each trace, tracestat reports:
+ *   - histograms of the malloc and realloc request sizes,
+ *   - the lifetimes of blocks, measured in requests from the malloc
+ *     to the matching free,
+ *   - the live-bytes curve (the total payload that is allocated after
+ *     each request), sampled at evenly spaced points,
+ *   - the lengths of realloc chains (reallocs of one block) and the
+ *     growth factor (new size / old size) of each realloc, and
+ *   - how block size and lifetime are related.
+ *
+ * The trace is read once, one request at a time, so memory use depends
+ * on the number of block ids and not on the length of the trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#define MAXLINE 1024   /* max string size */
+#define NBUCKETS 40    /* log2 buckets: [2^i, 2^(i+1)) */
+#define NPOINTS 20     /* default points on the live-bytes curve */
+#define NCHAINS 11     /* realloc chain lengths 0..9 and 10+ */
+#define NGROWTH 8      /* realloc growth factor buckets */
+
+/* Per block id state */
+typedef struct {
+    int born;        /* request that allocated the block, -1 if not live */
+    int size;        /* current payload size */
+    int first_size;  /* size at malloc */
+    int reallocs;    /* reallocs of this block so far */
+} block_t;
+
+/* Everything we learn about one trace */
+typedef struct {
+    long long size_hist[2][NBUCKETS]; /* malloc, realloc request sizes */
+    long long life_hist[NBUCKETS];    /* block lifetimes in requests */
+    long long life_by_size[NBUCKETS]; /* total lifetime per size bucket */
+    long long freed_by_size[NBUCKETS];/* blocks freed per size bucket */
+    long long chain_hist[NCHAINS];    /* reallocs per freed block */
+    long long growth_hist[NGROWTH];   /* realloc growth factors */
+    double log_growth;                /* sum of log(growth factor) */
+    long long nallocs, nreallocs, nfrees, nleaked;
+    long long bytes_alloc;            /* sum of malloc request sizes */
+    long long live, peak;             /* live payload bytes */
+    int peak_op;
+    double sx, sy, sxx, syy, sxy;     /* for corr(log size, log life) */
+    long long npairs;
+} tstats_t;
+
+/* Upper bounds of the growth factor buckets; the last is open */
+static double growth_bounds[NGROWTH-1] = {0.5, 1.0, 1.0001, 1.25, 1.5, 2.0, 4.0};
+static char *growth_names[NGROWTH] = {
+    "<0.5", "0.5-1", "1", "1-1.25", "1.25-1.5", "1.5-2", "2-4", ">=4"
+};
+
+static int npoints = NPOINTS;
+
+static void stat_trace(char *filename);
+static void print_stats(tstats_t *ts);
+static void print_hist(char *title, char *unit, long long *hist, int n);
+static int bucket(long long x);
+static void usage(void);
+static void app_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "p:h")) != EOF) {
+	switch (c) {
+	case 'p': /* Number of points on the live-bytes curve */
+	    npoints = atoi(optarg);
+	    if (npoints < 1) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind == argc) {
+	usage();
+	exit(1);
+    }
+    for (; optind < argc; optind++)
+	stat_trace(argv[optind]);
+    exit(0);
+}
+
+/*
+ * stat_trace - Read one trace (or stdin, for "-") and print its stats
+ */
+static void stat_trace(char *filename)
+{
+    FILE *fp;
+    char line[MAXLINE], type[MAXLINE], msg[MAXLINE];
+    int num_ids, num_ops, weight, sugg_heapsize;
+    int op, id, size, every, next_point, life, b, lineno;
+    block_t *blocks;
+    tstats_t ts;
+    double growth, x, y;
+
+    if (!strcmp(filename, "-"))
+	fp = stdin;
+    else if ((fp = fopen(filename, "r")) == NULL) {
+	sprintf(msg, "Could not open %.900s", filename);
+	app_error(msg);
+    }
+    if (fscanf(fp, "%d %d %d %d", &sugg_heapsize, &num_ids, &num_ops,
+	       &weight) != 4 || num_ids < 0 || num_ops < 0) {
+	sprintf(msg, "%.900s: bad trace header", filename);
+	app_error(msg);
+    }
+    if ((blocks = (block_t *)malloc((num_ids + 1) * sizeof(block_t))) == NULL)
+	app_error("malloc failed in stat_trace");
+    for (id = 0; id < num_ids; id++)
+	blocks[id].born = -1;
+    memset(&ts, 0, sizeof(ts));
+
+    printf("\n%s: %d requests on %d block ids\n", filename, num_ops, num_ids);
+    printf("\nLive bytes after each request:\n%12s%14s\n", "request", "live bytes");
+    every = (num_ops + npoints - 1) / npoints;
+    if (every < 1)
+	every = 1;
+    next_point = every - 1;
+
+    /* The header is lines 1-4, and the first fgets reads the rest of 4 */
+    op = 0;
+    lineno = 3;
+    while (fgets(line, MAXLINE, fp) != NULL) {
+	lineno++;
+	if (sscanf(line, "%s", type) != 1)
+	    continue; /* blank line, e.g. the rest of the header's */
+	if (sscanf(line, "%*s %d %d", &id, &size) < 1 ||
+	    id < 0 || id >= num_ids) {
+	    sprintf(msg, "%.900s: bad request on line %d", filename, lineno);
+	    app_error(msg);
+	}
+
+	switch (type[0]) {
+	case 'a':
+	    if (blocks[id].born >= 0) /* reused id: count the old one as freed */
+		ts.live -= blocks[id].size;
+	    blocks[id].born = op;
+	    blocks[id].size = blocks[id].first_size = size;
+	    blocks[id].reallocs = 0;
+	    ts.nallocs++;
+	    ts.bytes_alloc += size;
+	    ts.size_hist[0][bucket(size)]++;
+	    ts.live += size;
+	    break;
+
+	case 'r':
+	    ts.nreallocs++;
+	    ts.size_hist[1][bucket(size)]++;
+	    if (blocks[id].born < 0) { /* realloc(NULL, size) */
+		blocks[id].born = op;
+		blocks[id].size = blocks[id].first_size = size;
+		blocks[id].reallocs = 0;
+		ts.live += size;
+		break;
+	    }
+	    if (blocks[id].size > 0 && size > 0) {
+		growth = (double)size / blocks[id].size;
+		for (b = 0; b < NGROWTH-1 && growth >= growth_bounds[b]; b++)
+		    ;
+		ts.growth_hist[b]++;
+		ts.log_growth += log(growth);
+	    }
+	    ts.live += size - blocks[id].size;
+	    blocks[id].size = size;
+	    blocks[id].reallocs++;
+	    break;
+
+	case 'f':
+	    ts.nfrees++;
+	    if (blocks[id].born < 0)
+		break; /* free(NULL) */
+	    life = op - blocks[id].born;
+	    b = bucket(blocks[id].first_size);
+	    ts.life_hist[bucket(life)]++;
+	    ts.life_by_size[b] += life;
+	    ts.freed_by_size[b]++;
+	    ts.chain_hist[(blocks[id].reallocs < NCHAINS-1) ?
+			  blocks[id].reallocs : NCHAINS-1]++;
+
+	    /* Correlate log2 sizes and log2 lifetimes, streaming */
+	    x = log2(blocks[id].first_size + 1.0);
+	    y = log2(life + 1.0);
+	    ts.sx += x;
+	    ts.sy += y;
+	    ts.sxx += x * x;
+	    ts.syy += y * y;
+	    ts.sxy += x * y;
+	    ts.npairs++;
+
+	    ts.live -= blocks[id].size;
+	    blocks[id].born = -1;
+	    break;
+
+	default:
+	    sprintf(msg, "%.900s: bad request type '%c' on line %d",
+		    filename, type[0], lineno);
+	    app_error(msg);
+	}
+
+	if (ts.live > ts.peak) {
+	    ts.peak = ts.live;
+	    ts.peak_op = op;
+	}
+	if (op == next_point || op == num_ops - 1) {
+	    printf("%12d%14lld\n", op, ts.live);
+	    next_point += every;
+	}
+	op++;
+    }
+    if (fp != stdin)
+	fclose(fp);
+    if (op != num_ops)
+	printf("Warning: the header says %d requests, but there are %d\n",
+	       num_ops, op);
+
+    for (id = 0; id < num_ids; id++)
+	if (blocks[id].born >= 0)
+	    ts.nleaked++;
+    free(blocks);
+    print_stats(&ts);
+}
+
+/*
+ * print_stats - Print everything but the live-bytes curve
+ */
+static void print_stats(tstats_t *ts)
+{
+    double n, cov, varx, vary;
+    int b;
+
+    printf("Peak live bytes: %lld (after request %d)\n", ts->peak, ts->peak_op);
+    printf("\n%lld mallocs (mean %.1f bytes), %lld reallocs, %lld frees, "
+	   "%lld blocks never freed\n", ts->nallocs,
+	   ts->nallocs ? (double)ts->bytes_alloc / ts->nallocs : 0.0,
+	   ts->nreallocs, ts->nfrees, ts->nleaked);
+
+    print_hist("Malloc request sizes", "bytes", ts->size_hist[0], NBUCKETS);
+    if (ts->nreallocs > 0)
+	print_hist("Realloc request sizes", "bytes", ts->size_hist[1], NBUCKETS);
+    print_hist("Lifetimes of freed blocks", "requests", ts->life_hist,
+	       NBUCKETS);
+
+    if (ts->nreallocs > 0) {
+	printf("\nReallocs per freed block:\n%12s%12s\n", "reallocs", "blocks");
+	for (b = 0; b < NCHAINS; b++)
+	    if (ts->chain_hist[b] > 0)
+		printf("%11d%s%12lld\n", b, (b == NCHAINS-1) ? "+" : " ",
+		       ts->chain_hist[b]);
+	printf("\nRealloc growth factors (new size / old size):\n"
+	       "%12s%12s\n", "factor", "reallocs");
+	for (b = 0; b < NGROWTH; b++)
+	    if (ts->growth_hist[b] > 0)
+		printf("%12s%12lld\n", growth_names[b], ts->growth_hist[b]);
+	n = 0;
+	for (b = 0; b < NGROWTH; b++)
+	    n += ts->growth_hist[b];
+	if (n > 0)
+	    printf("Geometric mean growth factor: %.3f\n",
+		   exp(ts->log_growth / n));
+    }
+
+    printf("\nMean lifetime by malloc size:\n%12s%12s%14s\n",
+	   "bytes", "freed", "mean life");
+    for (b = 0; b < NBUCKETS; b++)
+	if (ts->freed_by_size[b] > 0)
+	    printf("%12lld%12lld%14.1f\n", 1LL << b, ts->freed_by_size[b],
+		   (double)ts->life_by_size[b] / ts->freed_by_size[b]);
+    n = ts->npairs;
+    if (n > 1) {
+	cov = ts->sxy / n - (ts->sx / n) * (ts->sy / n);
+	varx = ts->sxx / n - (ts->sx / n) * (ts->sx / n);
+	vary = ts->syy / n - (ts->sy / n) * (ts->sy / n);
+	if (varx > 0 && vary > 0)
+	    printf("Correlation of log2(size) and log2(lifetime): %.3f\n",
+		   cov / sqrt(varx * vary));
+	else
+	    printf("Correlation of log2(size) and log2(lifetime): undefined\n");
+    }
+}
+
+/*
+ * print_hist - Print the nonempty buckets of a log2 histogram
+ */
+static void print_hist(char *title, char *unit, long long *hist, int n)
+{
+    long long total = 0;
+    int b, lo = n, hi = -1;
+
+    for (b = 0; b < n; b++) {
+	total += hist[b];
+	if (hist[b] > 0) {
+	    if (b < lo)
+		lo = b;
+	    hi = b;
+	}
+    }
+    printf("\n%s:\n%24s%12s%8s\n", title, unit, "count", "pct");
+    for (b = lo; b <= hi; b++)
+	printf("%11lld - %10lld%12lld%7.1f%%\n", (b == 0) ? 0 : 1LL << b,
+	       (1LL << (b+1)) - 1, hist[b], 100.0 * hist[b] / total);
+}
+
+/*
+ * bucket - Return the log2 bucket of x (x in [2^b, 2^(b+1)), 0 and 1
+ *     both go in bucket 0)
+ */
+static int bucket(long long x)
+{
+    int b = 0;
+
+    while (x > 1 && b < NBUCKETS-1) {
+	x >>= 1;
+	b++;
+    }
+    return b;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracestat [-h] [-p <points>] <file.rep>...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h          Print this message.\n");
+    fprintf(stderr, "\t-p <points> Points on the live-bytes curve (default %d).\n",
+	    NPOINTS);
+    fprintf(stderr, "\t<file.rep>  Trace to characterize, or - for stdin.\n");
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    printf("%s\n", msg);
+    exit(1);
+}